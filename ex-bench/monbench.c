@@ -0,0 +1,39 @@
+#include "nSystem.h"
+#include <stdlib.h>
+#include <time.h>
+
+/*************************************************************
+ * Mide el costo de un par nEnter/nExit cuando ninguna otra
+ * tarea espera el monitor.
+ *
+ *   monbench [iteraciones]
+ *************************************************************/
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+int nMain(int argc, char **argv)
+{
+  int n= argc>=2 ? atoi(argv[1]) : 1000000;
+  nMonitor mon= nMakeMonitor();
+  double start, elapsed;
+  int i;
+
+  start= Now();
+  for (i= 0; i<n; i++)
+  {
+    nEnter(mon);
+    nExit(mon);
+  }
+  elapsed= Now()-start;
+
+  nPrintf("nEnter/nExit sin contencion: %d iteraciones, %d ns por par\n",
+          n, (int)(elapsed/n));
+
+  nDestroyMonitor(mon);
+  return 0;
+}
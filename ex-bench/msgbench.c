@@ -0,0 +1,84 @@
+#include "nSystem.h"
+#include <stdlib.h>
+
+/*************************************************************
+ * Mide el costo de una ida y vuelta nSend/nReply, la misma ida y
+ * vuelta con un servidor que usa nReplyAndReceive, y el de un
+ * mensaje en un sentido con nPost.
+ *
+ *   msgbench [iteraciones]
+ *************************************************************/
+
+int Server(int n)
+{
+  int i;
+
+  for (i= 0; i<n; i++)
+  {
+    nTask client;
+    nReceive(&client, -1);
+    nReply(client, 0);
+  }
+
+  return 0;
+}
+
+int FastServer(int n)
+{
+  int i;
+  nTask client= NULL;
+
+  for (i= 0; i<n; i++)
+    nReplyAndReceive(client, 0, &client, -1);
+  nReply(client, 0);
+
+  return 0;
+}
+
+int Sink(int n)
+{
+  int i;
+
+  for (i= 0; i<n; i++)
+    nReceive(NULL, -1);
+
+  return 0;
+}
+
+int nMain(int argc, char **argv)
+{
+  int n= argc>=2 ? atoi(argv[1]) : 1000000;
+  int i, start, elapsed;
+  nTask server= nEmitTask(Server, n);
+
+  start= nGetTime();
+  for (i= 0; i<n; i++)
+    nSend(server, NULL);
+  elapsed= nGetTime()-start;
+  nWaitTask(server);
+
+  nPrintf("nSend/nReply: %d iteraciones, %d ns por ida y vuelta\n",
+          n, (int)(elapsed*1000000.0/n));
+
+  server= nEmitTask(FastServer, n);
+  start= nGetTime();
+  for (i= 0; i<n; i++)
+    nSend(server, NULL);
+  elapsed= nGetTime()-start;
+  nWaitTask(server);
+
+  nPrintf("nSend/nReplyAndReceive: %d iteraciones, %d ns por ida y vuelta\n",
+          n, (int)(elapsed*1000000.0/n));
+
+  server= nEmitTask(Sink, n);
+  start= nGetTime();
+  for (i= 0; i<n; i++)
+    nPost(server, NULL, TRUE);
+  nWaitTask(server);
+  elapsed= nGetTime()-start;
+
+  nPrintf("nPost: %d mensajes, %d ns por mensaje\n",
+          n, (int)(elapsed*1000000.0/n));
+
+  return 0;
+}
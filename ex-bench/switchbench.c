@@ -0,0 +1,54 @@
+#include "nSysimp.h"
+#include "nSystem.h"
+#include <stdlib.h>
+#include <time.h>
+
+/*************************************************************
+ * Mide el costo de un cambio de contexto: dos tareas se ceden
+ * la CPU mutuamente pasando por la cola ready.
+ *
+ *   switchbench [iteraciones]
+ *************************************************************/
+
+static void Yield()
+{
+  START_CRITICAL();
+  PutTask(ready_queue, current_task);
+  ResumeNextReadyTask();
+  END_CRITICAL();
+}
+
+int Yielder(int n)
+{
+  int i;
+
+  for (i= 0; i<n; i++)
+    Yield();
+
+  return 0;
+}
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+int nMain(int argc, char **argv)
+{
+  int n= argc>=2 ? atoi(argv[1]) : 1000000;
+  nTask other= nEmitTask(Yielder, n);
+  double start, elapsed;
+
+  start= Now();
+  Yielder(n);
+  elapsed= Now()-start;
+  nWaitTask(other);
+
+  /* Cada iteracion de las dos tareas son 2 cambios de contexto */
+  nPrintf("Cambio de contexto: %d iteraciones, %d ns por cambio\n",
+          n, (int)(elapsed/(2.0*n)));
+
+  return 0;
+}
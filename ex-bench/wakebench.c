@@ -0,0 +1,174 @@
+#include "nSysimp.h"
+#include "nSystem.h"
+#include <stdlib.h>
+#include <time.h>
+
+/*************************************************************
+ * Compara las politicas de nSetWakePolicy.  Para cada una mide:
+ *
+ *   sem: costo por item de un productor y un consumidor unidos por
+ *        un buffer de BUFSIZE items (dos semaforos).
+ *   msg: costo de un par nSend/nReply.
+ *   lat: tiempo desde el nSignalSem hasta que la tarea despertada
+ *        corre, con NBUSY tareas mas en la cola ready.
+ *
+ *   wakebench [iteraciones]
+ *************************************************************/
+
+#define BUFSIZE 16
+#define NBUSY 4
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+static void Yield()
+{
+  START_CRITICAL();
+  PutTask(ready_queue, current_task);
+  ResumeNextReadyTask();
+  END_CRITICAL();
+}
+
+/* sem */
+
+static nSem empty, full;
+
+static int Consumer(int n)
+{
+  int i;
+
+  for (i= 0; i<n; i++)
+  {
+    nWaitSem(full);
+    nSignalSem(empty);
+  }
+  return 0;
+}
+
+static double SemBench(int n)
+{
+  nTask consumer;
+  double start;
+  int i;
+
+  empty= nMakeSem(BUFSIZE);
+  full= nMakeSem(0);
+  consumer= nEmitTask(Consumer, n);
+  start= Now();
+  for (i= 0; i<n; i++)
+  {
+    nWaitSem(empty);
+    nSignalSem(full);
+  }
+  nWaitTask(consumer);
+  start= Now()-start;
+  nDestroySem(empty);
+  nDestroySem(full);
+  return start/n;
+}
+
+/* msg */
+
+static int Server(int n)
+{
+  int i;
+  nTask client;
+
+  for (i= 0; i<n; i++)
+  {
+    nReceive(&client, -1);
+    nReply(client, 0);
+  }
+  return 0;
+}
+
+static double MsgBench(int n)
+{
+  nTask server= nEmitTask(Server, n);
+  double start= Now();
+  int i;
+
+  for (i= 0; i<n; i++)
+    nSend(server, NULL);
+  nWaitTask(server);
+  return (Now()-start)/n;
+}
+
+/* lat */
+
+static nSem wake;
+static double signaled, latency;
+static int woken, stop;
+
+static int Sleeper(int n)
+{
+  int i;
+
+  for (i= 0; i<n; i++)
+  {
+    nWaitSem(wake);
+    latency+= Now()-signaled;
+    woken= TRUE;
+  }
+  return 0;
+}
+
+static int Busy()
+{
+  while (!stop)
+    Yield();
+  return 0;
+}
+
+static double LatBench(int n)
+{
+  nTask sleeper, busy[NBUSY];
+  int i;
+
+  wake= nMakeSem(0);
+  latency= 0;
+  stop= FALSE;
+  sleeper= nEmitTask(Sleeper, n);
+  for (i= 0; i<NBUSY; i++)
+    busy[i]= nEmitTask(Busy);
+  for (i= 0; i<n; i++)
+  {
+    woken= FALSE;
+    signaled= Now();
+    nSignalSem(wake);
+    while (!woken)
+      Yield();
+  }
+  stop= TRUE;
+  nWaitTask(sleeper);
+  for (i= 0; i<NBUSY; i++)
+    nWaitTask(busy[i]);
+  nDestroySem(wake);
+  return latency/n;
+}
+
+int nMain(int argc, char **argv)
+{
+  static char *names[]= { "WAKE_HANDOFF", "WAKE_FRONT", "WAKE_BACK" };
+  int n= argc>=2 ? atoi(argv[1]) : 1000000;
+  int policy;
+
+  nPrintf("%-13s %8s %8s %8s  (ns, %d iteraciones)\n",
+          "politica", "sem", "msg", "lat", n);
+  for (policy= WAKE_HANDOFF; policy<=WAKE_BACK; policy++)
+  {
+    double sem, msg, lat;
+    nSetWakePolicy(policy);
+    sem= SemBench(n);
+    msg= MsgBench(n);
+    lat= LatBench(n/10);
+    nPrintf("%-13s %8d %8d %8d\n", names[policy],
+            (int)sem, (int)msg, (int)lat);
+  }
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <nSystem.h>
+
+/* Pruebas de nWaitOnAddress/nWakeAddress: un latch sobre un entero,
+ * despertar de a una tarea, timeouts y direcciones que comparten cola.
+ */
+
+#define NWORDS 1024
+
+static int latch= 0, woke= 0;
+static int words[NWORDS];
+
+/* Espera hasta que *addr deje de ser 0, como se usa un futex */
+static int Waiter(int *addr)
+{
+  while (*addr==0)
+    nWaitOnAddress(addr, 0, -1);
+  woke++;
+  return 0;
+}
+
+/* Espera una vez sobre latch y anota su numero en order */
+static int order[NWORDS], norder= 0;
+
+static int Ticket(int id)
+{
+  nWaitOnAddress(&latch, 0, -1);
+  order[norder++]= id;
+  return 0;
+}
+
+int nMain(int argc, char **argv)
+{
+  nTask tasks[NWORDS];
+  int i, start;
+
+  nPrintf("Un latch despierta a todas las tareas\n");
+  for (i= 0; i<10; i++)
+    tasks[i]= nEmitTask(Waiter, &latch);
+  nSleep(10);
+  if (woke!=0)
+    nFatalError("nMain", "Una tarea no espero el latch\n");
+  latch= 1;
+  if (nWakeAddress(&latch, -1)!=10)
+    nFatalError("nMain", "nWakeAddress no desperto a las 10 tareas\n");
+  for (i= 0; i<10; i++)
+    nWaitTask(tasks[i]);
+  nPrintf("Ok\n");
+
+  nPrintf("nWakeAddress despierta solo n tareas\n");
+  latch= 0;
+  for (i= 0; i<3; i++)
+    tasks[i]= nEmitTask(Waiter, &latch);
+  nSleep(10);
+  if (nWakeAddress(&latch, 1)!=1)
+    nFatalError("nMain", "nWakeAddress(1) no desperto a una tarea\n");
+  nSleep(10); /* La despertada vuelve a esperar: latch sigue en 0 */
+  latch= 1;
+  if (nWakeAddress(&latch, -1)!=3)
+    nFatalError("nMain", "Quedaron tareas sin despertar\n");
+  for (i= 0; i<3; i++)
+    nWaitTask(tasks[i]);
+  nPrintf("Ok\n");
+
+  nPrintf("nWaitOnAddress no espera si el valor cambio y respeta el timeout\n");
+  if (!nWaitOnAddress(&latch, 0, -1))
+    nFatalError("nMain", "nWaitOnAddress espero con otro valor\n");
+  if (nWaitOnAddress(&latch, 1, 0))
+    nFatalError("nMain", "nWaitOnAddress(0) no retorno falso\n");
+  start= nGetTime();
+  if (nWaitOnAddress(&latch, 1, 20))
+    nFatalError("nMain", "nWaitOnAddress no respeto el timeout\n");
+  if (nGetTime()-start<20)
+    nFatalError("nMain", "nWaitOnAddress retorno antes del timeout\n");
+  if (nWakeAddress(&latch, -1)!=0)
+    nFatalError("nMain", "La tarea no salio de la cola con el timeout\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Direcciones que comparten cola se despiertan por separado\n");
+  woke= 0;
+  for (i= 0; i<NWORDS; i++)
+    tasks[i]= nEmitTask(Waiter, &words[i]);
+  nSleep(10);
+  for (i= 0; i<NWORDS; i++)
+  {
+    words[i]= 1;
+    if (nWakeAddress(&words[i], -1)!=1)
+      nFatalError("nMain", "nWakeAddress desperto a otra direccion\n");
+  }
+  for (i= 0; i<NWORDS; i++)
+    nWaitTask(tasks[i]);
+  if (woke!=NWORDS)
+    nFatalError("nMain", "Faltaron tareas por despertar\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Despertar de a una respeta el orden de llegada\n");
+  latch= 0;
+  for (i= 0; i<NWORDS; i++)
+    tasks[i]= nEmitTask(Ticket, i);
+  nSleep(10);
+  for (i= 0; i<NWORDS; i++)
+    if (nWakeAddress(&latch, 1)!=1)
+      nFatalError("nMain", "nWakeAddress(1) no desperto a una tarea\n");
+  if (nWakeAddress(&latch, -1)!=0)
+    nFatalError("nMain", "Quedaron tareas en la cola\n");
+  for (i= 0; i<NWORDS; i++)
+    nWaitTask(tasks[i]);
+  for (i= 0; i<NWORDS; i++)
+    if (order[i]!=i)
+      nFatalError("nMain", "Se desperto fuera de orden\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Felicitaciones: nWaitOnAddress paso todos los tests.\n");
+  return 0;
+}
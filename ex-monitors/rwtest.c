@@ -0,0 +1,106 @@
+#include <nSystem.h>
+#include <string.h>
+
+/* Pruebas de nRWLock: los lectores comparten el candado, los
+ * escritores lo tienen solos y con preferencia a los escritores un
+ * lector nuevo espera a los escritores que ya esperaban.
+ */
+
+static nRWLock lock;
+static int inside= 0, max_inside= 0, writing= FALSE;
+static char order[16];
+static int norder= 0;
+
+static int Reader(int delay, int id)
+{
+  nReadLock(lock);
+  if (writing)
+    nFatalError("Reader", "Lee mientras alguien escribe\n");
+  if (id!=0)
+    order[norder++]= id;
+  if (++inside>max_inside)
+    max_inside= inside;
+  nSleep(delay);
+  inside--;
+  nReadUnlock(lock);
+  return 0;
+}
+
+static int Writer(int delay, int id)
+{
+  nWriteLock(lock);
+  if (writing || inside>0)
+    nFatalError("Writer", "Escribe mientras otro tiene el candado\n");
+  if (id!=0)
+    order[norder++]= id;
+  writing= TRUE;
+  nSleep(delay);
+  writing= FALSE;
+  nWriteUnlock(lock);
+  return 0;
+}
+
+/* Lanza en orden: lector a, escritor W y lector b, y entrega en que
+ * orden obtuvieron el candado.  Las demas pruebas usan id 0.
+ */
+
+static char *Run(int writer_pref)
+{
+  nTask a, w, b;
+
+  lock= nMakeRWLock(writer_pref);
+  norder= 0;
+  a= nEmitTask(Reader, 50, 'a');
+  nSleep(10);
+  w= nEmitTask(Writer, 50, 'W');
+  nSleep(10);
+  b= nEmitTask(Reader, 10, 'b');
+  nWaitTask(a);
+  nWaitTask(w);
+  nWaitTask(b);
+  nDestroyRWLock(lock);
+  order[norder]= 0;
+  return order;
+}
+
+int nMain(int argc, char **argv)
+{
+  nTask tasks[10];
+  int i;
+  char *res;
+
+  nPrintf("Los lectores comparten el candado\n");
+  lock= nMakeRWLock(FALSE);
+  for (i= 0; i<10; i++)
+    tasks[i]= nEmitTask(Reader, 20, 0);
+  for (i= 0; i<10; i++)
+    nWaitTask(tasks[i]);
+  if (max_inside!=10)
+    nFatalError("nMain", "Solo %d lectores a la vez\n", max_inside);
+  nDestroyRWLock(lock);
+  nPrintf("Ok\n");
+
+  nPrintf("Los escritores tienen el candado solos\n");
+  lock= nMakeRWLock(FALSE);
+  for (i= 0; i<10; i++)
+    tasks[i]= i%2==0 ? nEmitTask(Writer, 5, 0) : nEmitTask(Reader, 5, 0);
+  for (i= 0; i<10; i++)
+    nWaitTask(tasks[i]);
+  nDestroyRWLock(lock);
+  nPrintf("Ok\n");
+
+  nPrintf("Sin preferencia un lector entra aunque espere un escritor\n");
+  res= Run(FALSE);
+  if (strcmp(res, "abW")!=0)
+    nFatalError("nMain", "Orden %s en vez de abW\n", res);
+  nPrintf("Ok\n");
+
+  nPrintf("Con preferencia a los escritores el lector espera\n");
+  res= Run(TRUE);
+  if (strcmp(res, "aWb")!=0)
+    nFatalError("nMain", "Orden %s en vez de aWb\n", res);
+  nPrintf("Ok\n");
+
+  nPrintf("Felicitaciones: nRWLock paso todos los tests.\n");
+  return 0;
+}
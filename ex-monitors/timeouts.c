@@ -0,0 +1,153 @@
+#include <nSystem.h>
+
+/* Pruebas de las variantes con timeout: nWaitSemTimeout, nEnterTimeout,
+ * nWaitConditionTimeout, nSendTimeout y nWaitTaskTimeout.  Cuando vence
+ * el timeout la tarea debe quedar fuera de la cola en que esperaba.
+ */
+
+static nSem sem;
+static nMonitor mon;
+static nCondition cond;
+
+static int Signaler(int delay)
+{
+  nSleep(delay);
+  nSignalSem(sem);
+  return 0;
+}
+
+static int Holder(int delay)
+{
+  nEnter(mon);
+  nSleep(delay);
+  nExit(mon);
+  return 0;
+}
+
+static int Notifier(int delay)
+{
+  nSleep(delay);
+  nEnter(mon);
+  nSignalCondition(cond);
+  nExit(mon);
+  return 0;
+}
+
+static int Server(int delay)
+{
+  nTask client;
+  nSleep(delay);
+  if (nReceive(&client, 0)==NULL)
+    return 0; /* El cliente retiro su mensaje */
+  nReply(client, 7);
+  return 1;
+}
+
+static int Sleeper(int delay)
+{
+  nSleep(delay);
+  return 5;
+}
+
+static void CheckTime(int start, int min, char *what)
+{
+  int elapsed= nGetTime()-start;
+  if (elapsed<min || elapsed>min+50)
+    nFatalError("CheckTime", "%s tardo %d ms en vez de %d\n",
+                what, elapsed, min);
+}
+
+int nMain(int argc, char **argv)
+{
+  nTask t;
+  int start, rc;
+
+  nPrintf("nWaitSemTimeout\n");
+  sem= nMakeSem(0);
+  if (nTryWaitSem(sem))
+    nFatalError("nMain", "nTryWaitSem obtuvo una ficha inexistente\n");
+  start= nGetTime();
+  if (nWaitSemTimeout(sem, 20))
+    nFatalError("nMain", "nWaitSemTimeout no respeto el timeout\n");
+  CheckTime(start, 20, "nWaitSemTimeout");
+  t= nEmitTask(Signaler, 10);
+  if (!nWaitSemTimeout(sem, 100))
+    nFatalError("nMain", "nWaitSemTimeout no recibio el signal\n");
+  nWaitTask(t);
+  nDestroySem(sem); /* Falla si quedo alguna tarea en la cola */
+  nPrintf("Ok\n");
+
+  nPrintf("nEnterTimeout\n");
+  mon= nMakeMonitor();
+  t= nEmitTask(Holder, 50);
+  nSleep(1);
+  if (nTryEnter(mon))
+    nFatalError("nMain", "nTryEnter entro a un monitor ocupado\n");
+  start= nGetTime();
+  if (nEnterTimeout(mon, 20))
+    nFatalError("nMain", "nEnterTimeout no respeto el timeout\n");
+  CheckTime(start, 20, "nEnterTimeout");
+  if (!nEnterTimeout(mon, 100))
+    nFatalError("nMain", "nEnterTimeout no obtuvo el monitor\n");
+  nExit(mon);
+  nWaitTask(t);
+  if (!nTryEnter(mon))
+    nFatalError("nMain", "nTryEnter no entro a un monitor libre\n");
+  nPrintf("Ok\n");
+
+  nPrintf("nWaitConditionTimeout\n");
+  cond= nMakeCondition(mon);
+  start= nGetTime();
+  if (nWaitConditionTimeout(cond, 20))
+    nFatalError("nMain", "nWaitConditionTimeout no respeto el timeout\n");
+  CheckTime(start, 20, "nWaitConditionTimeout");
+  t= nEmitTask(Notifier, 10);
+  if (!nWaitConditionTimeout(cond, 100))
+    nFatalError("nMain", "nWaitConditionTimeout no recibio el signal\n");
+  nExit(mon);
+  nWaitTask(t);
+  nEnter(mon); /* El monitor debe haber quedado libre */
+  nExit(mon);
+  nDestroyCondition(cond);
+  nDestroyMonitor(mon);
+  nPrintf("Ok\n");
+
+  nPrintf("nSendTimeout\n");
+  t= nEmitTask(Server, 40);
+  if (nSendTimeout(t, "hola", 0, &rc))
+    nFatalError("nMain", "nSendTimeout(0) espero al receptor\n");
+  start= nGetTime();
+  if (nSendTimeout(t, "hola", 20, &rc))
+    nFatalError("nMain", "nSendTimeout no respeto el timeout\n");
+  CheckTime(start, 20, "nSendTimeout");
+  if (nWaitTask(t)!=0)
+    nFatalError("nMain", "El servidor recibio un mensaje retirado\n");
+  t= nEmitTask(Server, 10);
+  if (!nSendTimeout(t, "hola", 100, &rc) || rc!=7)
+    nFatalError("nMain", "nSendTimeout no obtuvo la respuesta\n");
+  nWaitTask(t);
+  nPrintf("Ok\n");
+
+  nPrintf("nWaitTaskTimeout\n");
+  t= nEmitTask(Sleeper, 40);
+  start= nGetTime();
+  if (nWaitTaskTimeout(t, 20, &rc))
+    nFatalError("nMain", "nWaitTaskTimeout no respeto el timeout\n");
+  CheckTime(start, 20, "nWaitTaskTimeout");
+  if (!nWaitTaskTimeout(t, 100, &rc) || rc!=5)
+    nFatalError("nMain", "nWaitTaskTimeout no obtuvo el codigo de retorno\n");
+  nPrintf("Ok\n");
+
+  /* Timers en los niveles superiores de la rueda (mas de 64 ms) */
+  nPrintf("Timeouts largos\n");
+  start= nGetTime();
+  t= nEmitTask(Sleeper, 300);
+  nSleep(100);
+  CheckTime(start, 100, "nSleep(100)");
+  nWaitTask(t);
+  CheckTime(start, 300, "nSleep(300)");
+  nPrintf("Ok\n");
+
+  nPrintf("Felicitaciones: las variantes con timeout pasaron todos los tests.\n");
+  return 0;
+}
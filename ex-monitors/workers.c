@@ -0,0 +1,137 @@
+#include <nSystem.h>
+
+/* Pruebas del modo M:N (nSetWorkers): las tareas corren en varios
+ * threads del nucleo y se sincronizan con monitores, semaforos y
+ * mensajes igual que en el modo de un solo thread.
+ */
+
+#define WORKERS 4
+#define TASKS 40
+#define ITER 500
+
+static nMonitor mon;
+static int count= 0;
+static int turn= 0;
+
+static int Adder(int n)
+{
+  int i;
+  for (i= 0; i<n; i++)
+  {
+    nEnter(mon);
+    count++;
+    nExit(mon);
+    if (i%50==0)
+      nSleep(1);
+  }
+  return n;
+}
+
+/* Las tareas avanzan por turno: cada una espera el suyo con nWait */
+static int Taker(int id)
+{
+  int i;
+  for (i= 0; i<ITER/10; i++)
+  {
+    nEnter(mon);
+    while (turn%TASKS!=id)
+      nWait(mon);
+    turn++;
+    nNotifyAll(mon);
+    nExit(mon);
+  }
+  return 0;
+}
+
+static int Pinger(nSem sems[2])
+{
+  int i;
+  for (i= 0; i<ITER; i++)
+  {
+    nWaitSem(sems[0]);
+    nSignalSem(sems[1]);
+  }
+  return 0;
+}
+
+static int Server(int n)
+{
+  int i;
+  for (i= 0; i<n; i++)
+  {
+    nTask client;
+    int *pv= (int *)nReceive(&client, -1);
+    nReply(client, *pv+1);
+  }
+  return 0;
+}
+
+static int Client(nTask server)
+{
+  int i;
+  for (i= 0; i<ITER; i++)
+    if (nSend(server, &i)!=i+1)
+      nFatalError("Client", "Respuesta incorrecta\n");
+  return 0;
+}
+
+int nMain(int argc, char **argv)
+{
+  nTask tasks[TASKS];
+  nTask server;
+  nSem sems[2];
+  int i;
+
+  nSetWorkers(WORKERS);
+
+  nPrintf("Exclusion mutua con %d workers\n", WORKERS);
+  mon= nMakeMonitor();
+  for (i= 0; i<TASKS; i++)
+    tasks[i]= nEmitTask(Adder, ITER);
+  for (i= 0; i<TASKS; i++)
+    if (nWaitTask(tasks[i])!=ITER)
+      nFatalError("nMain", "Adder retorno un valor incorrecto\n");
+  if (count!=TASKS*ITER)
+    nFatalError("nMain", "El contador vale %d en vez de %d\n",
+                count, TASKS*ITER);
+  nPrintf("Ok\n");
+
+  nPrintf("nWait y nNotifyAll\n");
+  for (i= 0; i<TASKS; i++)
+    tasks[i]= nEmitTask(Taker, i);
+  for (i= 0; i<TASKS; i++)
+    nWaitTask(tasks[i]);
+  if (turn!=TASKS*(ITER/10))
+    nFatalError("nMain", "Se perdieron turnos\n");
+  nDestroyMonitor(mon);
+  nPrintf("Ok\n");
+
+  nPrintf("Semaforos\n");
+  sems[0]= nMakeSem(0);
+  sems[1]= nMakeSem(0);
+  tasks[0]= nEmitTask(Pinger, sems);
+  for (i= 0; i<ITER; i++)
+  {
+    nSignalSem(sems[0]);
+    nWaitSem(sems[1]);
+  }
+  nWaitTask(tasks[0]);
+  nDestroySem(sems[0]);
+  nDestroySem(sems[1]);
+  nPrintf("Ok\n");
+
+  nPrintf("Mensajes\n");
+  server= nEmitTask(Server, 4*ITER);
+  for (i= 0; i<4; i++)
+    tasks[i]= nEmitTask(Client, server);
+  for (i= 0; i<4; i++)
+    nWaitTask(tasks[i]);
+  nWaitTask(server);
+  nPrintf("Ok\n");
+
+  if (nGetContextSwitches()<=0)
+    nFatalError("nMain", "El worker no cuenta sus cambios de contexto\n");
+
+  nPrintf("Felicitaciones: el modo M:N paso todos los tests.\n");
+  return 0;
+}
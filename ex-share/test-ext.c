@@ -0,0 +1,565 @@
+#include <nSystem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pruebas de las extensiones de nShare.  Ver el nMain al final */
+
+static char *retired[10];
+static int nretired = 0;
+
+static void retire(char *data)
+{
+  retired[nretired++] = data;
+}
+
+/* Pide una version a t, la usa durante busy milisegs. y la libera.
+ * Retorna el caracter compartido.
+ */
+static int reader(nTask t, int idle, int busy)
+{
+  char *data;
+  int value;
+  nSleep(idle);
+  data = nRequest(t, -1);
+  if (data == NULL)
+    nFatalError("reader", "nRequest retorno NULL\n");
+  value = *data;
+  nSleep(busy);
+  if (*data != value)
+    nFatalError("reader", "La version cambio mientras se usaba\n");
+  nRelease(t);
+  return value;
+}
+
+/****************************************************
+ * nShareVersion
+ ****************************************************/
+
+static void testVersions()
+{
+  static char v1 = '1', v2 = '2', v3 = '3';
+  nTask self = nCurrentTask();
+  nTask r1, r2;
+  int start;
+
+  nPrintf("nShareVersion sin nRequest pendientes retorna de inmediato\n");
+  start = nGetTime();
+  nShareVersion(&v1, retire);
+  if (nGetTime() - start > 5 || nretired != 0)
+    nFatalError("nMain", "nShareVersion no retorno de inmediato\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Un nRequest obtiene la ultima version sin esperar\n");
+  r1 = nEmitTask(reader, self, 0, 100);
+  nSleep(10);
+  start = nGetTime();
+  nShareVersion(&v2, retire); /* r1 tiene v1 por 100 milisegs. */
+  if (nGetTime() - start > 5)
+    nFatalError("nMain", "nShareVersion espero al lector lento\n");
+  if (nretired != 0)
+    nFatalError("nMain", "Se retiro una version en uso\n");
+  r2 = nEmitTask(reader, self, 0, 10);
+  if (nWaitTask(r2) != '2')
+    nFatalError("nMain", "r2 no obtuvo la ultima version\n");
+  nPrintf("Ok\n");
+
+  nPrintf("La version antigua se retira con su ultimo nRelease\n");
+  if (nWaitTask(r1) != '1')
+    nFatalError("nMain", "r1 no obtuvo la version 1\n");
+  if (nretired != 1 || retired[0] != &v1)
+    nFatalError("nMain", "No se retiro la version 1\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Un nRequest que espera recibe la proxima version\n");
+  nShareVersion(NULL, NULL);
+  if (nretired != 2 || retired[1] != &v2)
+    nFatalError("nMain", "No se retiro la version 2\n");
+  r1 = nEmitTask(reader, self, 0, 0);
+  nSleep(10);
+  nShareVersion(&v3, retire);
+  if (nWaitTask(r1) != '3')
+    nFatalError("nMain", "r1 no obtuvo la version 3\n");
+  nShareVersion(NULL, NULL);
+  if (nretired != 3 || retired[2] != &v3)
+    nFatalError("nMain", "No se retiro la version 3\n");
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * nRequestFresh
+ ****************************************************/
+
+static char cfg1 = 'a', cfg2 = 'b';
+static int shared2 = FALSE;
+
+/* Comparte cfg1 con el primer lector y cfg2 cuando recibe un mensaje */
+static int publisher()
+{
+  nSleep(10);
+  nShare(&cfg1);
+  nReceive(NULL, -1);
+  nShare(&cfg2);
+  shared2 = TRUE;
+  return 0;
+}
+
+static void testFresh()
+{
+  nTask p = nEmitTask(publisher);
+  char *data;
+  int start;
+
+  nPrintf("nRequestFresh entrega el ultimo dato compartido si es reciente\n");
+  data = nRequest(p, -1);
+  if (data != &cfg1)
+    nFatalError("testFresh", "nRequest no obtuvo cfg1\n");
+  nRelease(p);
+  start = nGetTime();
+  data = nRequestFresh(p, 50, 10);
+  if (data != &cfg1 || nGetTime() - start > 1)
+    nFatalError("testFresh", "nRequestFresh no uso el ultimo dato\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Un dato antiguo retenido no bloquea el proximo nShare\n");
+  nPost(p, NULL, FALSE);
+  nSleep(5);
+  if (!shared2)
+    nFatalError("testFresh", "nShare espero un nRelease de un dato antiguo\n");
+  nRelease(p);
+  data = nRequestFresh(p, 50, 10);
+  if (data != &cfg2)
+    nFatalError("testFresh", "nRequestFresh no obtuvo cfg2\n");
+  nRelease(p);
+  nPrintf("Ok\n");
+
+  nPrintf("nRequestFresh espera si el dato es muy antiguo\n");
+  nSleep(60);
+  start = nGetTime();
+  if (nRequestFresh(p, 50, 20) != NULL)
+    nFatalError("testFresh", "nRequestFresh entrego un dato muy antiguo\n");
+  if (nGetTime() - start < 20)
+    nFatalError("testFresh", "nRequestFresh no espero el timeout\n");
+  nWaitTask(p);
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * nRequestAny
+ ****************************************************/
+
+static char anyA = 'A', anyB = 'B', anyC = 'C';
+
+/* Espera delay milisegs. y comparte data */
+static int delayedShare(int delay, char *data)
+{
+  nSleep(delay);
+  nShare(data);
+  return 0;
+}
+
+/* Publica data con nShareVersion hasta recibir un mensaje */
+static int versioner(char *data)
+{
+  nShareVersion(data, NULL);
+  nReceive(NULL, -1);
+  nShareVersion(NULL, NULL);
+  return 0;
+}
+
+static void testAny()
+{
+  nTask tasks[3];
+  char *data;
+  int which = -1, start;
+
+  nPrintf("nRequestAny obtiene el dato del primero que comparte\n");
+  tasks[0] = nEmitTask(delayedShare, 50, &anyA);
+  tasks[1] = nEmitTask(delayedShare, 10, &anyB);
+  data = nRequestAny(tasks, 2, -1, &which);
+  if (data != &anyB || which != 1)
+    nFatalError("testAny", "nRequestAny no obtuvo el primer dato\n");
+  nRelease(tasks[which]);
+  start = nGetTime();
+  nWaitTask(tasks[0]); /* se colgaria si la solicitud siguiera en su cola */
+  nWaitTask(tasks[1]);
+  if (nGetTime() - start > 60)
+    nFatalError("testAny", "El segundo nShare espero un nRelease\n");
+  nPrintf("Ok\n");
+
+  nPrintf("nRequestAny retorna NULL si nadie comparte antes del timeout\n");
+  tasks[0] = nEmitTask(delayedShare, 40, &anyA);
+  tasks[1] = nEmitTask(delayedShare, 40, &anyB);
+  which = -1;
+  if (nRequestAny(tasks, 2, 20, &which) != NULL || which != -1)
+    nFatalError("testAny", "nRequestAny no respeto el timeout\n");
+  nWaitTask(tasks[0]);
+  nWaitTask(tasks[1]);
+  nPrintf("Ok\n");
+
+  nPrintf("nRequestAny no espera si alguno ya esta compartiendo\n");
+  tasks[0] = nEmitTask(delayedShare, 40, &anyA);
+  tasks[1] = nEmitTask(delayedShare, 40, &anyB);
+  tasks[2] = nEmitTask(versioner, &anyC);
+  start = nGetTime();
+  data = nRequestAny(tasks, 3, -1, &which);
+  if (data != &anyC || which != 2 || nGetTime() - start > 5)
+    nFatalError("testAny", "nRequestAny no obtuvo la version publicada\n");
+  nRelease(tasks[2]);
+  nPost(tasks[2], NULL, FALSE);
+  nWaitTask(tasks[0]);
+  nWaitTask(tasks[1]);
+  nWaitTask(tasks[2]);
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * nRequestLease
+ ****************************************************/
+
+static char leased = 'L';
+
+/* Pide con un plazo de lease milisegs. pero se demora busy en liberar */
+static int slowReader(nTask t, int lease, int busy)
+{
+  char *data = nRequestLease(t, -1, lease);
+  if (data != &leased)
+    nFatalError("slowReader", "nRequestLease no obtuvo el dato\n");
+  nSleep(busy);
+  nRelease(t);
+  return 0;
+}
+
+static void testLease()
+{
+  nTask self = nCurrentTask();
+  nTask r1, r2;
+  int start;
+
+  nPrintf("nShare no espera a un lector cuyo plazo vencio\n");
+  r1 = nEmitTask(slowReader, self, 20, 200);
+  r2 = nEmitTask(slowReader, self, 100, 0);
+  nSleep(10);
+  start = nGetTime();
+  nShare(&leased);
+  if (nGetTime() - start < 15 || nGetTime() - start > 60)
+    nFatalError("testLease", "nShare no retorno al vencer el plazo\n");
+  if (nGetExpiredLeases() != 1)
+    nFatalError("testLease", "No se conto el plazo vencido\n");
+  nPrintf("Ok\n");
+
+  nPrintf("El nRelease atrasado no hace nada\n");
+  nWaitTask(r1);
+  nWaitTask(r2);
+  if (nGetExpiredLeases() != 1)
+    nFatalError("testLease", "Se conto un plazo que no vencio\n");
+  nPrintf("Ok\n");
+}
+
+/* Los Hold salen de un slab que no se limpia: un plazo no debe depender
+ * de lo que dejo en el heap un bloque liberado.  Por eso corre primero,
+ * antes de que el slab tenga Holds reciclados.
+ */
+static void testLeaseChurn()
+{
+  nTask self = nCurrentTask();
+  nTask r;
+  char *blocks[8];
+  int i;
+
+  nPrintf("nRequestLease despues de ensuciar el heap\n");
+  for (i = 0; i < 8; i++)
+  {
+    blocks[i] = malloc(16384);
+    memset(blocks[i], 0x5a, 16384);
+  }
+  for (i = 0; i < 8; i++)
+    free(blocks[i]);
+  r = nEmitTask(slowReader, self, 20, 0);
+  nSleep(10);
+  nShare(&leased);
+  nWaitTask(r);
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * nRequest con timeout
+ ****************************************************/
+
+static char answer = 'T';
+
+/* Pide con un plazo de timeout milisegs. y anota si obtuvo el dato */
+static int timedRequester(nTask t, int timeout)
+{
+  char *data = nRequest(t, timeout);
+  if (data == NULL)
+    return 0;
+  if (data != &answer)
+    nFatalError("timedRequester", "nRequest no obtuvo el dato\n");
+  nRelease(t);
+  return 1;
+}
+
+static void testTimedOutWaiter()
+{
+  nTask self = nCurrentTask();
+  nTask first, middle, last, lone;
+
+  /* La tarea del medio y luego la unica que queda vencen y terminan antes
+   * del nShare: si siguieran en la lista de espera, nShare despertaria a
+   * una tarea que ya termino.
+   */
+  nPrintf("Una tarea cuyo timeout vencio sale de la lista de espera\n");
+  first = nEmitTask(timedRequester, self, -1);
+  middle = nEmitTask(timedRequester, self, 20);
+  last = nEmitTask(timedRequester, self, -1);
+  if (nWaitTask(middle) != 0)
+    nFatalError("testTimedOutWaiter", "nRequest no respeto el timeout\n");
+  lone = nEmitTask(timedRequester, self, 20);
+  nSleep(40);
+  nShare(&answer);
+  if (nWaitTask(first) != 1 || nWaitTask(last) != 1)
+    nFatalError("testTimedOutWaiter", "Una tarea no obtuvo el dato\n");
+  if (nWaitTask(lone) != 0)
+    nFatalError("testTimedOutWaiter", "nRequest no respeto el timeout\n");
+  nPrintf("Ok\n");
+}
+
+static void testMessageToRequester()
+{
+  nTask self = nCurrentTask();
+  nTask t;
+  int rc;
+
+  /* Una tarea en nRequest no esta en nReceive: nPost solo deja el
+   * mensaje en su buzon y nSendTimeout con plazo 0 no lo entrega.
+   */
+  nPrintf("Un mensaje no despierta a una tarea que espera en nRequest\n");
+  t = nEmitTask(timedRequester, self, -1);
+  nSleep(10);
+  nPost(t, &answer, FALSE);
+  if (nSendTimeout(t, &answer, 0, &rc))
+    nFatalError("testMessageToRequester", "nSend entrego el mensaje\n");
+  nSleep(10);
+  nShare(&answer);
+  if (nWaitTask(t) != 1)
+    nFatalError("testMessageToRequester", "La tarea no obtuvo el dato\n");
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * nShareNamed, nRequestNamed y nReleaseNamed
+ ****************************************************/
+
+#define NKEYS 100
+
+static char values[NKEYS];
+
+/* Pide key y retorna el caracter obtenido */
+static int namedReader(char *key)
+{
+  char *data = nRequestNamed(key, -1);
+  int value = *data;
+  nReleaseNamed(key);
+  return value;
+}
+
+/* Publica dos nombres desde la misma tarea */
+static int namedPublisher()
+{
+  nSleep(10);
+  nShareNamed("a", &values[0], retire);
+  nShareNamed("b", &values[1], retire);
+  return 0;
+}
+
+static void testNamed()
+{
+  char key[10];
+  nTask r, p;
+  int i;
+
+  nPrintf("Una tarea publica varios nombres sin esperar\n");
+  for (i = 0; i < NKEYS; i++)
+    values[i] = i;
+  nretired = 0;
+  r = nEmitTask(namedReader, "b");
+  p = nEmitTask(namedPublisher);
+  nWaitTask(p);
+  if (nWaitTask(r) != 1)
+    nFatalError("testNamed", "El lector no obtuvo b\n");
+  if (nRequestNamed("a", -1) != &values[0])
+    nFatalError("testNamed", "nRequestNamed no obtuvo a\n");
+  nShareNamed("a", &values[2], retire);
+  if (nretired != 0)
+    nFatalError("testNamed", "Se retiro una version en uso\n");
+  nReleaseNamed("a");
+  if (nretired != 1 || retired[0] != &values[0])
+    nFatalError("testNamed", "No se retiro la version antigua\n");
+  nShareNamed("a", NULL, NULL);
+  nShareNamed("b", NULL, NULL);
+  if (nRequestNamed("a", 10) != NULL)
+    nFatalError("testNamed", "nRequestNamed obtuvo un nombre retirado\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Muchos nombres independientes\n");
+  for (i = 0; i < NKEYS; i++)
+  {
+    sprintf(key, "k%d", i);
+    nShareNamed(key, &values[i], NULL);
+  }
+  for (i = NKEYS - 1; i >= 0; i--)
+  {
+    sprintf(key, "k%d", i);
+    if (nRequestNamed(key, 10) != &values[i])
+      nFatalError("testNamed", "nRequestNamed obtuvo el dato equivocado\n");
+    nReleaseNamed(key);
+    nShareNamed(key, NULL, NULL);
+  }
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * nShareLazy
+ ****************************************************/
+
+static int produced = 0;
+static char snapshot;
+
+/* Un calculo caro: demora 20 milisegs. */
+static char *produce(void *arg)
+{
+  nSleep(20);
+  produced++;
+  snapshot = *(char *)arg;
+  return &snapshot;
+}
+
+static int lazyPublisher(char *value)
+{
+  for (;;)
+  {
+    if (nShareLazy(produce, value) != &snapshot)
+      nFatalError("lazyPublisher", "nShareLazy no retorno el dato producido\n");
+    if (snapshot == 'Z')
+      return 0;
+  }
+}
+
+static void testLazy()
+{
+  static char value = 'X';
+  nTask p, r[3];
+  int i;
+
+  nPrintf("nShareLazy no produce si nadie pide\n");
+  p = nEmitTask(lazyPublisher, &value);
+  nSleep(50);
+  if (produced != 0)
+    nFatalError("testLazy", "Se produjo el dato sin nRequest\n");
+  nPrintf("Ok\n");
+
+  /* Un mensaje no debe despertar al productor: las solicitudes que
+   * siguen lo encontrarian ya en la cola ready.
+   */
+  nPost(p, &value, FALSE);
+
+  nPrintf("Las solicitudes que llegan mientras se produce reciben el mismo dato\n");
+  for (i = 0; i < 3; i++)
+    r[i] = nEmitTask(reader, p, 0, 0);
+  for (i = 0; i < 3; i++)
+    if (nWaitTask(r[i]) != 'X')
+      nFatalError("testLazy", "Un lector no obtuvo el dato producido\n");
+  if (produced != 1)
+    nFatalError("testLazy", "Se produjo %d veces\n", produced);
+  nPrintf("Ok\n");
+
+  value = 'Z';
+  r[0] = nEmitTask(reader, p, 0, 0);
+  if (nWaitTask(r[0]) != 'Z' || produced != 2)
+    nFatalError("testLazy", "No se produjo el segundo dato\n");
+  nWaitTask(p);
+}
+
+/****************************************************
+ * nSetStreamSize y nReadStream
+ ****************************************************/
+
+static char updates[32];
+
+/* Espera la proxima actualizacion de t a partir de seq, a lo mas 1 seg. */
+static int subscriber(nTask t, unsigned seq)
+{
+  char *item;
+  if (nReadStream(t, &seq, &item, 1, 1000) != 1)
+    nFatalError("subscriber", "nReadStream no entrego la actualizacion\n");
+  return *item;
+}
+
+static void testStream()
+{
+  nTask self = nCurrentTask();
+  char *items[8];
+  unsigned seq = 0;
+  nTask sub;
+  int i, n;
+
+  nPrintf("nReadStream entrega todas las actualizaciones en orden\n");
+  for (i = 0; i < 32; i++)
+    updates[i] = i;
+  nSetStreamSize(8);
+  for (i = 0; i < 5; i++)
+    nShareVersion(&updates[i], NULL);
+  n = nReadStream(self, &seq, items, 4, -1);
+  if (n != 4 || seq != 4 || items[0] != &updates[0] || items[3] != &updates[3])
+    nFatalError("testStream", "El primer lote esta mal\n");
+  n = nReadStream(self, &seq, items, 8, -1);
+  if (n != 1 || seq != 5 || items[0] != &updates[4])
+    nFatalError("testStream", "El segundo lote esta mal\n");
+  if (nReadStream(self, &seq, items, 8, 10) != 0)
+    nFatalError("testStream", "nReadStream no respeto el timeout\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Un suscriptor que espera recibe la proxima actualizacion\n");
+  sub = nEmitTask(subscriber, self, seq);
+  nSleep(10);
+  nPost(sub, &updates[0], FALSE); /* No lo despierta */
+  nSleep(10);
+  nShareVersion(&updates[5], NULL);
+  if (nWaitTask(sub) != 5)
+    nFatalError("testStream", "El suscriptor no recibio la actualizacion\n");
+  nPrintf("Ok\n");
+
+  nPrintf("nReadStream detecta cuando se queda atras\n");
+  for (i = 6; i < 32; i++)
+    nShareVersion(&updates[i], NULL);
+  if (nReadStream(self, &seq, items, 8, -1) != -1 || seq != 24)
+    nFatalError("testStream", "No se detecto el desborde\n");
+  n = nReadStream(self, &seq, items, 8, -1);
+  if (n != 8 || seq != 32 || items[0] != &updates[24] || items[7] != &updates[31])
+    nFatalError("testStream", "No se leyo lo que quedaba en el anillo\n");
+  nShareVersion(NULL, NULL);
+  nPrintf("Ok\n");
+}
+
+/****************************************************
+ * Programa principal
+ ****************************************************/
+
+int nMain(int argc, char **argv)
+{
+  if (argc == 2) /* test-ext archivo: anota los eventos (ver src/nlogdump) */
+    nSetLogFile(nOpen(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  testLeaseChurn();
+  testVersions();
+  testFresh();
+  testAny();
+  testLease();
+  testTimedOutWaiter();
+  testMessageToRequester();
+  testNamed();
+  testLazy();
+  testStream();
+  nPrintf("Felicitaciones: las extensiones de nShare pasaron todos los tests.\n");
+  return 0;
+}
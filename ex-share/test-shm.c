@@ -0,0 +1,122 @@
+#include <nSystem.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* Pruebas de nShmShare/nShmRequest.  Ver el nMain al final.
+ * El programa se invoca a si mismo como segundo proceso:
+ *   test-shm child <segmento>
+ */
+
+#define SIZE (1<<20)
+
+static int ticks = 0, stop = FALSE;
+
+/* Muestra que el proceso sigue atendiendo otras tareas */
+static int ticker()
+{
+  while (!stop)
+  {
+    nSleep(1);
+    ticks++;
+  }
+  return 0;
+}
+
+/* Pide el segmento y verifica que el dato este completo */
+static int shmReader(nShm shm, int timeout)
+{
+  char *data = nShmRequest(shm, timeout);
+  int value, i;
+  if (data == NULL)
+    return -1;
+  value = data[0];
+  for (i = 1; i < nShmLength(shm); i++)
+    if (data[i] != value)
+      nFatalError("shmReader", "El dato compartido esta incompleto\n");
+  nShmRelease(shm);
+  return value;
+}
+
+/* El segundo proceso: pide 3 datos y verifica que sean cada vez mas nuevos */
+static int child(char *name)
+{
+  nShm shm = nShmOpen(name, SIZE);
+  int i, value, last = -1;
+  if (shm == NULL)
+    nFatalError("child", "No se pudo abrir %s\n", name);
+  for (i = 0; i < 3; i++)
+  {
+    value = shmReader(shm, -1);
+    if (value <= last)
+      nFatalError("child", "Recibio un dato antiguo\n");
+    last = value;
+  }
+  nShmClose(shm);
+  return 0;
+}
+
+int nMain(int argc, char **argv)
+{
+  char name[64];
+  nShm pub, sub;
+  nTask t, r;
+  int i, rc, pid, status = 0, done = FALSE;
+
+  if (argc == 3 && strcmp(argv[1], "child") == 0)
+    return child(argv[2]);
+
+  sprintf(name, "/nsys-test-shm-%d", getpid());
+  pub = nShmOpen(name, SIZE);
+  sub = nShmOpen(name, SIZE); /* como si fuera otro proceso */
+  if (pub == NULL || sub == NULL)
+    nFatalError("nMain", "No se pudo crear el segmento\n");
+  t = nEmitTask(ticker);
+
+  nPrintf("nShmRequest espera el proximo nShmShare sin detener el proceso\n");
+  r = nEmitTask(shmReader, sub, -1);
+  nSleep(50);
+  if (ticks < 10)
+    nFatalError("nMain", "El proceso se detuvo durante la espera\n");
+  if (nSendTimeout(r, &i, 0, &rc)) /* El lector no esta en nReceive */
+    nFatalError("nMain", "nSend le entrego un mensaje al lector\n");
+  memset(nShmData(pub), 7, SIZE);
+  nShmShare(pub, SIZE);
+  if (nWaitTask(r) != 7)
+    nFatalError("nMain", "El lector no obtuvo el dato\n");
+  nPrintf("Ok\n");
+
+  nPrintf("nShmRequest retorna NULL si nadie comparte antes del timeout\n");
+  if (shmReader(sub, 20) != -1)
+    nFatalError("nMain", "nShmRequest no respeto el timeout\n");
+  nPrintf("Ok\n");
+
+  nPrintf("Otro proceso recibe los datos sin copiarlos\n");
+  pid = fork();
+  if (pid == 0)
+  {
+    execl(argv[0], argv[0], "child", name, (char *)NULL);
+    _exit(127);
+  }
+  for (i = 0; !done; i++)
+  {
+    memset(nShmData(pub), i % 100, 4096);
+    nShmShare(pub, 4096);
+    nSleep(5);
+    done = waitpid(pid, &status, WNOHANG) == pid;
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    nFatalError("nMain", "Fallo el segundo proceso\n");
+  nPrintf("Ok\n");
+
+  stop = TRUE;
+  nWaitTask(t);
+  nShmClose(sub);
+  nShmClose(pub);
+  shm_unlink(name);
+  nPrintf("Felicitaciones: nShmShare paso todos los tests.\n");
+  return 0;
+}
@@ -115,13 +115,14 @@ static int TtyServer()
 {
   int refresh_tty= 0;
   int quit_tty= 0;
+  nTask sender= NULL;
 
   nSetTaskName("Servidor para el despliegue en la tty");
 
   while ( !quit_tty )
   {
-    nTask sender;
-    Request *req= (Request*)nReceive(&sender, -1);
+    /* Responde al cliente anterior y recibe el proximo pedido */
+    Request *req= (Request*)nReplyAndReceive(sender, 0, &sender, -1);
 
     if (req->op==CLR)
     {
@@ -162,10 +163,10 @@ static int TtyServer()
     }
     else if (req->op==QUIT)
       quit_tty= 1;
-
-    nReply(sender, 0);
   }
 
+  nReply(sender, 0);
+
   return 0;
 }
 
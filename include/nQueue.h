@@ -4,7 +4,7 @@
  *************************************************************/
 
 #define TYPE_QUEUE  1
-#define TYPE_SQUEUE 2
+#define TYPE_WHEEL  2
 /*
  * Manejo de colas FIFO
  */
@@ -30,27 +30,44 @@ int QueueLength(Queue queue);           /* Entrega el largo de la cola */
 int QueryTask(Queue queue, nTask task); /* Verdadero si task esta en la cola */
 void DeleteTaskQueue(Queue queue, nTask task );
                                         /* Borra una tarea de la cola */
+void AppendQueue(Queue queue, Queue src);
+                                        /* Mueve src al final de queue */
 void DestroyQueue(Queue queue);         /* El destructor */
 
 #define DeleteTaskInQueue DeleteTaskQueue
 
 /*
- * Manejo de colas ordenadas por tiempo
+ * Rueda de tiempo jerarquica: timers ordenados por tiempo de vencimiento
+ * con insercion y cancelacion O(1).  Hay WHEEL_LEVELS niveles de
+ * WHEEL_SIZE ranuras; la ranura i del nivel n cubre 64^n milisegundos.
+ * Los timers de niveles superiores bajan de nivel (``cascada'') a
+ * medida que avanza el tiempo.  Los timers con vencimiento mas alla
+ * del ultimo nivel quedan en el ultimo nivel y siguen bajando hasta
+ * que les llega su turno.
  */
 
-typedef struct Squeue
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1<<WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE-1)
+#define WHEEL_LEVELS 4
+
+typedef struct TimeWheel
 {
   int type;
-  nTask first;
+  int base;     /* El proximo milisegundo por procesar */
+  int count;    /* Nro. de timers programados */
+  unsigned long long used[WHEEL_LEVELS];
+                /* Bit i: la ranura i puede tener timers */
+  Timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
 }
-  *Squeue;
-
-Squeue MakeSqueue();
-void PutTaskSqueue(Squeue squeue, nTask task, int wake_time);
-nTask GetTaskSqueue(Squeue squeue);
-int GetNextTimeSqueue(Squeue squeue);
-int EmptySqueue(Squeue squeue);
-void DeleteTaskSqueue(Squeue squeue, nTask task);
-void DestroySqueue(Squeue squeue);
+  *TimeWheel;
 
-#define DeleteTaskInSqueue DeleteTaskSqueue
+TimeWheel MakeTimeWheel(int now);
+void PutTimerWheel(TimeWheel wheel, Timer *timer, int wake_time);
+void DeleteTimerWheel(TimeWheel wheel, Timer *timer);
+int ExpireTimersWheel(TimeWheel wheel, int curr_time);
+                    /* Invoca expire de los timers vencidos a curr_time */
+int GetNextTimeWheel(TimeWheel wheel);
+                    /* Cota inferior del proximo vencimiento */
+int EmptyWheel(TimeWheel wheel);
+void DestroyTimeWheel(TimeWheel wheel);
@@ -32,10 +32,18 @@
   typedef void* nCondition;
 #endif
 
+#ifndef NOVOID_NRWLOCK
+  typedef void* nRWLock;
+#endif
+
 #ifndef NOVOID_NJMONITOR
   typedef void* nJMonitor;
 #endif
 
+#ifndef NOVOID_NSHM
+  typedef void* nShm;
+#endif
+
 /*************************************************************
  * La tarea principal provista por el programador
  *************************************************************/
@@ -54,6 +62,8 @@ nTask nEmitTask(nProc, ... );
                               /* Crea una nueva tarea */
 void nExitTask(int rc);       /* Termina la tarea que la invoca */
 int nWaitTask(nTask task);    /* Espera el termino de otra tarea */
+int nWaitTaskTimeout(nTask task, int timeout, int *prc);
+                              /* Falso si vence el timeout */
 
 void nExitSystem(int rc);     /* Termina todas las tareas
                                  (shutdown del proceso Unix) */
@@ -65,6 +75,14 @@ void nExitSystem(int rc);     /* Termina todas las tareas
 int  nSetStackSize(int size);  /* Taman~o de stack para las nuevas tareas */
 void nSetTimeSlice(int slice); /* Taman~o de la tajada (en ms) */
 void nSetTaskName(char *format, ... ); /* Util para debugging */
+void nSetWorkers(int n);       /* Modo M:N: n threads del nucleo */
+
+/* Que hacer al despertar a una tarea en nSignalSem, nReply y nRelease */
+#define WAKE_DEFAULT -1 /* La politica global (solo para nSetSemWakePolicy) */
+#define WAKE_HANDOFF 0  /* Cederle la CPU de inmediato (por omision) */
+#define WAKE_FRONT   1  /* Dejarla primera en la cola ready */
+#define WAKE_BACK    2  /* Dejarla ultima en la cola ready */
+int nSetWakePolicy(int policy); /* Fija la politica global */
 
 nTask nCurrentTask();          /* El identificador de la tarea actual */
 char* nGetTaskName();          /* El nombre de esta tarea */
@@ -76,9 +94,16 @@ int nGetQueueLength();
  *************************************************************/
 
 int nSend(nTask task, void *msg); /* Envia un mensaje a una tarea */
+int nSendTimeout(nTask task, void *msg, int timeout, int *prc);
+                                  /* Falso si no se recibe a tiempo */
 void *nReceive(nTask *ptask, int max_delay);
                                   /* Recepcion de un mensaje */
 void nReply(nTask task, int rc);  /* Responde un mensaje */
+void *nReplyAndReceive(nTask reply_to, int rc, nTask *ptask, int max_delay);
+                                  /* nReply seguido de nReceive */
+int nPost(nTask task, void *msg, int wait);
+                                  /* Envia un mensaje sin esperar nReply */
+int nSetMailboxSize(int size);    /* Capacidad de los buzones nuevos */
 
 void nSleep(int delay);           /* Suspende el proceso por delay milisecs */
 int nGetTime(); /* Entre la hora en milisegundos y modulo ``maxint'' */
@@ -89,8 +114,11 @@ int nGetTime(); /* Entre la hora en milisegundos y modulo ``maxint'' */
 
 nSem nMakeSem(int count);   /* Construye un semaforo */
 void nWaitSem(nSem sem);    /* Operacion Wait */
+int nWaitSemTimeout(nSem sem, int timeout); /* Falso si vence el timeout */
+int nTryWaitSem(nSem sem);  /* Wait sin esperar: falso si no hay fichas */
 void nSignalSem(nSem sem);  /* Operacion Signal */
 void nDestroySem(nSem sem); /* Destruye un semaforo */
+int nSetSemWakePolicy(nSem sem, int policy); /* Politica de nSignalSem */
 
 /*************************************************************
  * Monitores
@@ -100,6 +128,8 @@ void nDestroySem(nSem sem); /* Destruye un semaforo */
 nMonitor nMakeMonitor();             /* Construye un monitor */
 void nDestroyMonitor(nMonitor mon);  /* Destruye un monitor */
 void nEnter(nMonitor mon);           /* Ingreso al monitor */
+int nEnterTimeout(nMonitor mon, int timeout); /* Falso si vence */
+int nTryEnter(nMonitor mon);         /* Falso si esta ocupado */
 void nExit(nMonitor mon);            /* Salida del monitor */
 void nWait(nMonitor mon);            /* Libera el monitor y suspende */
 void nNotifyAll(nMonitor mon);       /* Retoma tareas suspendidas */
@@ -107,15 +137,76 @@ void nNotifyAll(nMonitor mon);       /* Retoma tareas suspendidas */
 nCondition nMakeCondition(nMonitor mon); /* Construye una condicion */
 void nDestroyCondition(nCondition cond); /* Destruye una condicion */
 void nWaitCondition(nCondition cond);    /* operacion Wait */
+int nWaitConditionTimeout(nCondition cond, int timeout);
+                                         /* Falso si vence el timeout */
 void nSignalCondition(nCondition cond);  /* operacion Signal */
 
+/*************************************************************
+ * Candados de lectores/escritores
+ *************************************************************/
+
+nRWLock nMakeRWLock(int writer_pref); /* writer_pref: preferir escritores */
+void nDestroyRWLock(nRWLock lock);    /* Destruye un candado */
+void nReadLock(nRWLock lock);         /* Obtiene el candado para leer */
+void nReadUnlock(nRWLock lock);       /* Lo libera despues de leer */
+void nWriteLock(nRWLock lock);        /* Obtiene el candado para escribir */
+void nWriteUnlock(nRWLock lock);      /* Lo libera despues de escribir */
+
+/*************************************************************
+ * Espera sobre una direccion (al estilo de un futex de Linux)
+ *************************************************************/
+
+int nWaitOnAddress(int *addr, int expected, int timeout);
+                         /* Espera un nWakeAddress si *addr==expected */
+int nWakeAddress(int *addr, int n); /* Despierta hasta n (<0 todas) */
+
+/*************************************************************
+ * Log binario de eventos internos (se lee con src/nlogdump)
+ *************************************************************/
+
+#define NLOG_NONE  0
+#define NLOG_ERROR 1
+#define NLOG_WARN  2
+#define NLOG_INFO  3
+#define NLOG_DEBUG 4
+
+int nSetLogFile(int fd);       /* fd<0 desactiva el log */
+int nSetLogLevel(int level);   /* Eventos con nivel <= level */
+
 /*************************************************************
  * Compartir datos
  *************************************************************/
 
 void nShare(char* data);
 char *nRequest(nTask t, int timeout);
+char *nRequestFresh(nTask t, int max_age, int timeout);
+                               /* Acepta el ultimo dato si es reciente */
+char *nRequestAny(nTask *tasks, int n, int timeout, int *which);
+                               /* Espera al primero de varios que comparta */
+char *nRequestLease(nTask t, int timeout, int lease);
+                               /* Se libera solo si no hay nRelease a tiempo */
+int nGetExpiredLeases(void);   /* Cuantos plazos de nRequestLease vencieron */
 void nRelease(nTask t);
+char *nShareLazy(char *(*produce)(void *arg), void *arg);
+                               /* Calcula el dato solo si alguien lo pide */
+void nShareVersion(char *data, void (*retire)(char *data));
+                               /* Publica una version sin esperar */
+void nSetStreamSize(int size);
+int nReadStream(nTask t, unsigned *seq, char **items, int max, int timeout);
+                               /* Lee todo lo compartido desde *seq */
+void nShareNamed(char *key, char *data, void (*retire)(char *data));
+char *nRequestNamed(char *key, int timeout);
+void nReleaseNamed(char *key);  /* Lo mismo, pero por nombre */
+
+/* Entre procesos, en un segmento de memoria compartida (Linux) */
+nShm nShmOpen(char *name, int size); /* Lo crea si no existe */
+void nShmClose(nShm shm);
+char *nShmData(nShm shm);      /* Donde se escribe lo que se comparte */
+int nShmSize(nShm shm);
+int nShmLength(nShm shm);      /* Bytes compartidos */
+void nShmShare(nShm shm, int len);
+char *nShmRequest(nShm shm, int timeout);
+void nShmRelease(nShm shm);
 
 /*************************************************************
  * E/S basica
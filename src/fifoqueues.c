@@ -1,4 +1,4 @@
-/* #include "nSysimp.h" */
+#include "nSysimp.h"
 #include "nSystem.h"
 #include "fifoqueues.h"
 
@@ -15,9 +15,13 @@ typedef struct FifoQueueElem
   void* obj;
 } FifoQueueElem;
 
+/* Los elementos se piden en cada PutObj/PushObj: vienen de un slab */
+static SlabCache fifo_cache= SLAB_CACHE(struct FifoQueue, sizeof(void *));
+static SlabCache elem_cache= SLAB_CACHE(FifoQueueElem, sizeof(void *));
+
 FifoQueue MakeFifoQueue() /* Puede ser llamada de cualquier parte */
 {
-  FifoQueue queue= (FifoQueue) nMalloc(sizeof(*queue));
+  FifoQueue queue= (FifoQueue) SlabAlloc(&fifo_cache);
   queue->first= NULL;
   queue->last= &queue->first;
   queue->len= 0;
@@ -27,7 +31,7 @@ FifoQueue MakeFifoQueue() /* Puede ser llamada de cualquier parte */
 
 void PutObj(FifoQueue queue, void* obj)
 {
-  FifoQueueElem* elem= (FifoQueueElem*)nMalloc(sizeof *elem);
+  FifoQueueElem* elem= (FifoQueueElem*)SlabAlloc(&elem_cache);
 
   elem->obj= obj;
   elem->next= NULL;
@@ -42,7 +46,7 @@ void PutObj(FifoQueue queue, void* obj)
 
 void PushObj(FifoQueue queue, void* obj)
 {
-  FifoQueueElem* elem= (FifoQueueElem*)nMalloc(sizeof *elem);
+  FifoQueueElem* elem= (FifoQueueElem*)SlabAlloc(&elem_cache);
   elem->obj= obj;
   elem->next= queue->first;
   queue->first= elem;
@@ -63,7 +67,7 @@ void* GetObj(FifoQueue queue)
   if (queue->first==NULL) queue->last= &queue->first;
 
   obj= elem->obj;
-  nFree(elem);
+  SlabFree(&elem_cache, elem);
 
   queue->len--;
 
@@ -98,7 +102,7 @@ void DeleteObj(FifoQueue queue, void* obj)
     }
     else if (queue->last==&elem->next)
       nFatalError("DeleteObj", "Inconsistencia, elem no es el ultimo\n");
-    nFree(elem);
+    SlabFree(&elem_cache, elem);
     queue->len--;
   }
 }
@@ -119,5 +123,5 @@ void DestroyFifoQueue(FifoQueue queue)
     nFatalError("DestroyFifoQueue",
                 "Se destruye una cola con tareas pendientes\n");
 
-  nFree(queue); /* Se supone que no hay procesos colgando */
+  SlabFree(&fifo_cache, queue); /* Se supone que no hay procesos colgando */
 }
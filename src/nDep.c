@@ -1,5 +1,8 @@
 #include "nSysimp.h"
 #include "nSystem.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /*************************************************************
  * Secciones Criticas:
@@ -9,28 +12,72 @@
  * En las secciones criticas no se permiten cambios de contexto implicitos.
  * Las secciones criticas se pueden anidar.  Para mayor seguridad
  * se trata de verificar el buen anidamiento de las secciones criticas.
+ *
+ * Las interrupciones no se enmascaran con sigprocmask (eso costaba dos
+ * llamadas al sistema por cada primitiva).  Todos los handlers pasan por
+ * DeferredHandler: si llega una senal dentro de una seccion critica
+ * (sig_level>0) solo se anota en pending_signals y el handler verdadero
+ * se invoca en el END_CRITICAL (o EndHandler) mas externo.
  */
 
-static int sig_level= 0; /* Se usa para el anidamiento de secc. criticas */
-static sigset_t old_Sigset;
+__thread volatile sig_atomic_t sig_level= 0;
+                          /* Se usa para el anidamiento de secc. criticas */
+static volatile unsigned long pending_signals= 0;
+                          /* Bit i: la senal i llego en una secc. critica */
+static void (*handlers[NSIG])(); /* Los handlers instalados con SetHandler */
+
+static void DeliverPending();
+
+/* En modo M:N (workers>1) varios threads ejecutan tareas.  sig_level
+ * es propio de cada thread y la seccion critica mas externa toma
+ * ademas big_lock, un candado global: a lo mas un thread esta dentro
+ * de nSystem, asi que las colas, los timers y las estructuras de todas
+ * las primitivas siguen protegidas igual que con un solo thread.  Un
+ * thread tiene el candado si y solo si su sig_level es positivo.  Los
+ * cambios de contexto ocurren con el candado tomado, por lo que una
+ * tarea suspendida en un thread solo puede ser retomada en otro
+ * despues de que el primero dejo su pila.
+ */
 
-void START_CRITICAL() /* Se deshabilitan las interrupciones */
+int workers= 1;
+
+static volatile int big_lock= 0; /* 0 libre, 1 tomado, 2 con espera */
+
+void LockWorkers()
 {
-  sigset_t curr_Sigset;
+  int c= __sync_val_compare_and_swap(&big_lock, 0, 1);
 
-  /* Cuidado: dos tareas pueden preguntar simultaneamente por sig_level==0 */
-  if (sig_level==0)
+  /* Con espera se anota 2 para que UnlockWorkers despierte a alguien.
+   * Una senal que interrumpe el futex queda diferida (sig_level>0).
+   */
+  if (c!=0)
   {
-    /* se deshabilitan las int. */
-    sigset_t new_Sigset;
+    if (c!=2)
+      c= __sync_lock_test_and_set(&big_lock, 2);
+    while (c!=0)
+    {
+      syscall(SYS_futex, &big_lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+      c= __sync_lock_test_and_set(&big_lock, 2);
+    }
+  }
+}
 
-    nAssert(sigfillset(&new_Sigset)==0, "sigfillset");
-    nAssert(sigprocmask(SIG_BLOCK, &new_Sigset, &curr_Sigset)==0, "sigprocmask");
+void UnlockWorkers()
+{
+  if (__sync_fetch_and_sub(&big_lock, 1)!=1)
+  {
+    big_lock= 0;
+    syscall(SYS_futex, &big_lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
   }
+}
 
-  /* Ahora si que puedo incrementar sig_level */
-  if (sig_level++==0) old_Sigset= curr_Sigset;
-  /* No hace nada cuando las interrupciones ya habian sido deshabilitadas */
+void START_CRITICAL() /* Se deshabilitan las interrupciones */
+{
+  /* Si una senal llega en medio del incremento, sig_level todavia es 0
+   * y el handler se ejecuta completo antes de que el incremento termine.
+   */
+  if (sig_level++==0 && workers>1)
+    LockWorkers();
 }
 
 void END_CRITICAL() /* Se rehabilitan las interrupciones */
@@ -38,15 +85,50 @@ void END_CRITICAL() /* Se rehabilitan las interrupciones */
   if (sig_level==0)
     nFatalError("END_CRITICAL", "Mal uso de secciones criticas\n");
 
-  if (--sig_level==0) {
-    nAssert(sigprocmask(SIG_SETMASK, &old_Sigset, NULL)==0, "sigprocmask"); /* se habilitan las int. */
+  if (sig_level==1 && workers>1)
+  {
+    KickWorkers(); /* Si quedan tareas ready, que otro worker las tome */
+    UnlockWorkers();
   }
 
+  /* Una senal que llega antes de que sig_level llegue a 0 queda
+   * pendiente, por eso se consulta pending_signals despues.
+   */
+  if (--sig_level==0 && pending_signals!=0)
+    DeliverPending(); /* se atienden las int. diferidas */
+
   /* Si sig_level>=1 quiere decir que todavia estamos en una
    * seccion critica => no se pueden deshabilitar las interrupciones.
    */
 }
 
+/* Invoca los handlers de las senales que quedaron pendientes.
+ * Un handler puede a su vez diferir nuevas senales, por eso se
+ * itera hasta que no quede ninguna.
+ */
+
+static void DeliverPending()
+{
+  while (pending_signals!=0)
+  {
+    int sig;
+    for (sig= 1; sig<NSIG && sig<8*sizeof(unsigned long); sig++)
+    {
+      unsigned long bit= 1UL<<sig;
+      if (__sync_fetch_and_and(&pending_signals, ~bit) & bit)
+        (*handlers[sig])();
+    }
+  }
+}
+
+static void DeferredHandler(int sig)
+{
+  if (sig_level!=0 && sig<8*sizeof(unsigned long))
+    __sync_fetch_and_or(&pending_signals, 1UL<<sig);
+  else
+    (*handlers[sig])();
+}
+
 /*************************************************************
  * Chequeo de funcionamiento de secciones criticas.
  * Existen para detectar si se invoca una interrupcion dentro
@@ -56,14 +138,30 @@ void END_CRITICAL() /* Se rehabilitan las interrupciones */
 
 void StartHandler()
 {
-  if (sig_level++!=0 && cpu_status==RUNNING)
-    nFatalError("StartHandler", "Mal uso de secciones criticas\n");
+  if (sig_level++!=0)
+  {
+    if (cpu_status==RUNNING)
+      nFatalError("StartHandler", "Mal uso de secciones criticas\n");
+  }
+  else if (workers>1)
+    LockWorkers();
 }
 
 void EndHandler()
 {
+  if (sig_level==1 && workers>1)
+  {
+    KickWorkers();
+    UnlockWorkers();
+  }
   if (--sig_level<0)
     nFatalError("EndHandler", "Mal uso de secciones criticas\n");
+
+  /* Como en END_CRITICAL: una senal que llego durante el handler no
+   * puede esperar a que alguna tarea salga de una seccion critica.
+   */
+  if (sig_level==0 && pending_signals!=0)
+    DeliverPending();
 }
 
 void VerifyCritical(char *str)
@@ -90,6 +188,9 @@ void _CallInNewStack( SP *from_psp, SP to_sp, void (*proc)(), void *ptr);
 #define _CallInNewStack CallInNewStack
 #endif
 
+#if !defined(__x86_64__) || defined(NO_INLINE_SWITCH)
+/* (En amd64 ChangeContext se expande en linea, ver nSysimp.h) */
+
 void ChangeContext(nTask this_task, nTask next_task)
 {
   int curr_sig_level= sig_level;
@@ -102,6 +203,8 @@ void ChangeContext(nTask this_task, nTask next_task)
   sig_level=curr_sig_level;
 }
 
+#endif
+
 void CallInNewContext(nTask this_task, nTask new_task,
                       void (*proc)(), void *ptr)
 {
@@ -118,15 +221,30 @@ void CallInNewContext(nTask this_task, nTask new_task,
 
 void WaitSignal()
 {
-  sigset_t Sigset;
+  sigset_t Sigset, old_Sigset;
 
+  /* Se esta dentro de una seccion critica, asi que las senales que
+   * lleguen quedan anotadas en pending_signals.  Para no perder una
+   * senal entre la consulta de pending_signals y la espera, se
+   * enmascaran las interrupciones solo mientras se espera.
+   */
   nAssert(sigfillset(&Sigset)==0, "sigfillset");
-  nAssert(sigdelset(&Sigset, SIGVTALRM)==0, "sigdelset");
-  nAssert(sigdelset(&Sigset, SIGALRM)==0, "sigdelset");
-  nAssert(sigdelset(&Sigset, SIGINT)==0, "sigdelset");
-  nAssert(sigdelset(&Sigset, SIGIO)==0, "sigdelset");
+  nAssert(sigprocmask(SIG_BLOCK, &Sigset, &old_Sigset)==0, "sigprocmask");
+
+  if (pending_signals==0)
+  {
+    nAssert(sigdelset(&Sigset, SIGVTALRM)==0, "sigdelset");
+    nAssert(sigdelset(&Sigset, SIGALRM)==0, "sigdelset");
+    nAssert(sigdelset(&Sigset, SIGINT)==0, "sigdelset");
+    nAssert(sigdelset(&Sigset, SIGIO)==0, "sigdelset");
+
+    WaitIO(&Sigset); /* epoll_pwait: E/S lista o alguna de esas senales */
+                     /* (en modo M:N suelta big_lock mientras espera) */
+  }
 
-  sigsuspend(&Sigset);
+  nAssert(sigprocmask(SIG_SETMASK, &old_Sigset, NULL)==0, "sigprocmask");
+
+  DeliverPending();
 }
 
 /*************************************************************
@@ -141,14 +259,26 @@ void WaitSignal()
 #define SA_RESETHAND 0
 #endif
 
+#ifndef SA_NODEFER
+#define SA_NODEFER 0
+#endif
+
 void SetHandler(int sigtype, void (*sighandler)())
 {
   struct sigaction Action;
 
-  Action.sa_handler= sighandler;
-  sigfillset(&Action.sa_mask);
+  /* SetAlarm reinstala el handler cada vez que programa el timer */
+  if (handlers[sigtype]==sighandler)
+    return;
+  handlers[sigtype]= sighandler;
+
+  Action.sa_handler= DeferredHandler;
+  /* No se enmascara nada: DeferredHandler difiere las senales que
+   * lleguen mientras se ejecuta un handler (sig_level>0).
+   */
+  sigemptyset(&Action.sa_mask);
   /* Action.sa_flags= SA_RESTART | SA_RESETHAND; */
-  Action.sa_flags= SA_RESTART;
+  Action.sa_flags= SA_RESTART | SA_NODEFER;
 
   sigaction(sigtype, &Action, NULL);
 }
@@ -0,0 +1,113 @@
+#include "nSysimp.h"
+#include "nSystem.h"
+
+/*************************************************************
+ * Espera sobre una direccion
+ *************************************************************/
+
+/* nWaitOnAddress y nWakeAddress permiten esperar sobre cualquier
+ * entero sin construir un semaforo o un monitor para el: un latch, un
+ * flag de inicializacion o un contador de secuencia.  Las tareas que
+ * esperan quedan en una tabla fija de NBUCKETS colas intrusivas,
+ * elegida segun un hash de la direccion.  Una cola se crea la primera
+ * vez que alguna tarea espera en ella, asi que un entero sobre el que
+ * nadie espera no cuesta nada.  Direcciones distintas pueden compartir
+ * una cola; cada tarea anota en wait_addr la direccion que espera.
+ */
+
+#define NBUCKETS_BITS 8
+#define NBUCKETS (1<<NBUCKETS_BITS)
+
+static Queue buckets[NBUCKETS];
+
+/* Hash multiplicativo: los bits altos del producto */
+
+static Queue *Bucket(int *addr)
+{
+  unsigned long h= ((unsigned long)addr>>2)*0x9e3779b97f4a7c15UL;
+  return &buckets[h>>(8*sizeof(h)-NBUCKETS_BITS)];
+}
+
+/* Si *addr==expected espera hasta que un nWakeAddress(addr, ...) la
+ * despierte, a lo mas timeout milisegundos (<0 es indefinidamente).
+ * La comparacion y el comienzo de la espera son atomicos respecto de
+ * las demas tareas.  Retorna falso si vencio el timeout o si no espero
+ * por tener timeout 0, y verdadero si *addr!=expected o la despertaron.
+ * Como con un futex, al retornar hay que volver a consultar *addr.
+ */
+
+int nWaitOnAddress(int *addr, int expected, int timeout)
+{
+  Queue *pbucket;
+  int ok= TRUE;
+
+  START_CRITICAL();
+
+  if (*addr!=expected)
+    ; /* Ya cambio */
+  else if (timeout==0)
+    ok= FALSE;
+  else
+  {
+    pbucket= Bucket(addr);
+    if (*pbucket==NULL)
+      *pbucket= MakeQueue();
+    current_task->wait_addr= addr;
+    if (timeout>0)
+    {
+      current_task->status= WAIT_ADDR_TIMEOUT;
+      ProgramQueueTask(timeout);
+    }
+    else
+      current_task->status= WAIT_ADDR;
+    PutTask(*pbucket, current_task);
+    ResumeNextReadyTask();
+    current_task->wait_addr= NULL;
+    ok= timeout<0 || !current_task->timed_out;
+  }
+
+  END_CRITICAL();
+
+  return ok;
+}
+
+/* Despierta hasta n tareas (todas si n<0) que esperan en addr, en el
+ * orden en que llegaron, y retorna cuantas desperto.  Las tareas
+ * quedan al final de la cola ready: quien despierta sigue con la CPU.
+ */
+
+int nWakeAddress(int *addr, int n)
+{
+  Queue bucket;
+  nTask task, *ptask;
+  int woken= 0;
+
+  START_CRITICAL();
+
+  bucket= *Bucket(addr);
+  /* Se desenlazan en su lugar, como en DeleteTaskQueue, las tareas que
+   * esperan addr; las demas no se tocan.  Se para apenas se desperto a n.
+   */
+  ptask= bucket==NULL ? NULL : &bucket->first;
+  while (ptask!=NULL && *ptask!=NULL && woken!=n)
+  {
+    task= *ptask;
+    if (task->wait_addr!=addr)
+    {
+      ptask= &task->next_task;
+      continue;
+    }
+    *ptask= task->next_task;
+    if (bucket->last==&task->next_task) bucket->last= ptask;
+    task->queue= NULL;
+    if (task->status==WAIT_ADDR_TIMEOUT)
+      CancelTask(task);
+    task->status= READY;
+    PutTask(ready_queue, task);
+    woken++;
+  }
+
+  END_CRITICAL();
+
+  return woken;
+}
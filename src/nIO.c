@@ -9,6 +9,23 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <string.h>
+
+/* io_uring para archivos regulares (ver UringInit).  Se compila con
+ * -DNO_IO_URING para no usarlo nunca.
+ */
+#if defined(__linux__) && !defined(NO_IO_URING)
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#else
+#define IORING_OP_READ 0
+#define IORING_OP_WRITE 0
+#endif
 
 /* Para ttyname e isatty: */
 #include <stdlib.h>
@@ -25,24 +42,62 @@
 static void SetNonBlocking(int fd); /* Coloca un fd en modo no bloqueante */
 static void SigioHandler(); /* Handler de interrupciones de E/S */
 static void AddWaitingTask(int fd, nTask task);
+static void AwakeIO(struct epoll_event *events, int nevents);
+                                  /* Despierta las tareas de events[] */
+static void GrowWaits(int fd);    /* Agranda io_waits para que quepa fd */
+static void UringInit();          /* Crea el anillo de io_uring si se puede */
+static void SetFileKind(int fd);  /* Decide si fd ira por io_uring */
+static int UseUring(int fd);      /* Verdadero si fd va por io_uring */
+static int UringRW(int op, int fd, char *buf, int nbyte, int status);
 
 /*************************************************************
  * El prologo y el epilogo
  *************************************************************/
 
-static nTask *pending_tasks; /* Tareas con E/S pendiente */
-static int maxsize_pending;  /* El taman~o de ambos vectores */
+/* Por cada descriptor se mantienen dos colas: las tareas que esperan
+ * poder leer y las que esperan poder escribir.  Asi una tarea puede
+ * esperar lectura y otra escritura sobre el mismo fd.  El vector
+ * crece a medida que aparecen descriptores mas grandes.  Las colas
+ * se crean la primera vez que se usan.
+ */
+
+typedef struct
+{
+  Queue readers;   /* Tareas en WAIT_READ sobre este fd */
+  Queue writers;   /* Tareas en WAIT_WRITE sobre este fd */
+  int registered;  /* Verdadero si el fd ya esta en epoll_fd */
+  int kind;        /* IO_POLL o IO_FILE */
+  int busy;        /* IO_FILE: hay una operacion en el anillo */
+} IOWait;
+
+#define IO_POLL 0 /* Socket, pipe, tty: se espera con epoll */
+#define IO_FILE 1 /* Archivo regular abierto con nOpen: va por io_uring */
+
+static IOWait *io_waits;    /* Indexado por fd */
+static int maxsize_waits;   /* El taman~o de io_waits */
+
+/* Cada fd se registra una sola vez en epoll, en modo ``edge
+ * triggered'' para lectura y escritura: el kernel avisa cuando
+ * cambia la disponibilidad y no hay que re-armar nada tras cada
+ * despertar.  Una tarea que no logra leer o escribir vuelve a
+ * recibir EAGAIN y se pone de nuevo en espera.
+ */
+
+#define MAX_EVENTS 256
+
+static int epoll_fd= -1;
+static struct epoll_event events[MAX_EVENTS]; /* Con el candado tomado */
 
 void IOInit()
 {
-  maxsize_pending=20;
-  pending_tasks= (nTask *)
-          malloc(maxsize_pending * sizeof(nTask));
+  maxsize_waits=64;
+  io_waits= (IOWait *) calloc(maxsize_waits, sizeof(IOWait));
 
-  { int i;
-    for (i=0; i<maxsize_pending; i++)
-      pending_tasks[i]= NULL;
-  }
+  epoll_fd= epoll_create1(EPOLL_CLOEXEC);
+  if (io_waits==NULL || epoll_fd<0)
+    nFatalError("IOInit", "No se pudo crear el epoll\n");
+
+  UringInit();
 
   SetHandler(SIGIO, SigioHandler);   /* Define el handler de E/S */
 }
@@ -75,7 +130,7 @@ void nSetNonBlockingStdio()
 
 void IOEnd()
 {
-  int i;
+  int fd, header= FALSE;
   int flags_in= fcntl(0, F_GETFL);
   int flags_out= fcntl(1, F_GETFL);
 
@@ -83,18 +138,26 @@ void IOEnd()
   fcntl(0, F_SETFL, flags_in&~O_NONBLOCK);
   fcntl(1, F_SETFL, flags_out&~O_NONBLOCK);
 
-  for (i=0; i<maxsize_pending; i++)
-    if (pending_tasks[i]!= NULL)
+  for (fd=0; fd<maxsize_waits; fd++)
+  {
+    Queue queues[2];
+    int k;
+
+    queues[0]= io_waits[fd].readers;
+    queues[1]= io_waits[fd].writers;
+    for (k=0; k<2; k++)
     {
-      nFprintf(2,"\nTareas con E/S pendiente:\n");
-      break;
+      nTask task;
+      if (queues[k]==NULL || EmptyQueue(queues[k]))
+        continue;
+      if (!header)
+      {
+        nFprintf(2,"\nTareas con E/S pendiente:\n");
+        header= TRUE;
+      }
+      for (task= queues[k]->first; task!=NULL; task= task->next_task)
+        DescribeTask(task);
     }
-
-  while (i<maxsize_pending)
-  {
-    if (pending_tasks[i]!= NULL)
-      DescribeTask(pending_tasks[i]);
-    i++;
   }
 }
 
@@ -114,7 +177,11 @@ int nOpen(char *path, int flags, ...)
     va_end(ap);
     
     fd= open(path, flags, mode);
-    if (fd>=0) SetNonBlocking(fd);
+    if (fd>=0)
+    {
+      SetNonBlocking(fd);
+      SetFileKind(fd);
+    }
   END_CRITICAL();
 
   return fd;
@@ -125,26 +192,57 @@ int nClose(int fd)
   int rc;
 
   START_CRITICAL();
+    /* Se saca de epoll antes de cerrar: si el fd fue duplicado el
+     * kernel no lo sacaria solo, y el numero se puede reutilizar.
+     */
+    if (fd>=0 && fd<maxsize_waits && io_waits[fd].registered)
+    {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      io_waits[fd].registered= FALSE;
+    }
+    if (fd>=0 && fd<maxsize_waits)
+      io_waits[fd].kind= IO_POLL;
     rc= close(fd);
   END_CRITICAL();
 
   return rc;
 }
 
+/* En modo M:N una tarea que cede la CPU puede volver en otro thread y
+ * errno es propio de cada thread.  Como el compilador puede calcular
+ * la direccion de errno una sola vez por funcion, despues de ceder la
+ * CPU errno se consulta o se fija en estas funciones aparte.
+ */
+
+static int __attribute__((noinline)) Again(int rc)
+{
+  return rc<0 && errno==EAGAIN;
+}
+
+static void __attribute__((noinline)) SetErrno(int err)
+{
+  errno= err;
+}
+
 int nRead(int fd, char *buf, int nbyte)
 {  
   int rc;
 
   START_CRITICAL();
 
+  if (UseUring(fd))
+    rc= UringRW(IORING_OP_READ, fd, buf, nbyte, WAIT_READ);
+  else
+  {
     rc= read(fd, buf, nbyte); /* Intentamos leer */
-    while (rc<0 && errno==EAGAIN)
+    while (Again(rc))
     {                         /* No hay nada disponible */
-      AddWaitingTask(fd, current_task);
       current_task->status= WAIT_READ;
+      AddWaitingTask(fd, current_task);
       ResumeNextReadyTask(); /* Pasamos a la proxima que este ready */
       rc= read(fd, buf, nbyte); /* Ahora si que deberia funcionar */
     }
+  }
 
   END_CRITICAL();
 
@@ -157,14 +255,19 @@ int nWrite(int fd, char *buf, int nbyte)
 
   START_CRITICAL();
 
+  if (UseUring(fd))
+    rc= UringRW(IORING_OP_WRITE, fd, buf, nbyte, WAIT_WRITE);
+  else
+  {
     rc= write(fd, buf, nbyte); /* Intentamos escribir */
-    while (rc<0 && errno==EAGAIN)
+    while (Again(rc))
     {                         /* El buffer esta lleno */
-      AddWaitingTask(fd, current_task);
       current_task->status= WAIT_WRITE;
+      AddWaitingTask(fd, current_task);
       ResumeNextReadyTask(); /* Pasamos a la proxima que este ready */
       rc= write(fd, buf, nbyte); /* Ahora deberia poder escribir un poco */
     }
+  }
 
   END_CRITICAL();
 
@@ -196,66 +299,485 @@ static void SetNonBlocking(int fd)
 #endif
 }
 
+/*************************************************************
+ * io_uring
+ *************************************************************/
+
+/* En un archivo regular O_NONBLOCK no tiene efecto: read nunca da
+ * EAGAIN y, si hay que ir al disco, bloquea el proceso completo con
+ * todas sus tareas.  Si el kernel ofrece io_uring, nRead y nWrite
+ * sobre archivos regulares (o dispositivos de bloques) envian la
+ * operacion al anillo y la tarea cede la CPU hasta que llegue la
+ * completacion.  Los sockets, pipes y ttys siguen con epoll.
+ *
+ * Las completaciones se recogen con ReapIO: al esperar en epoll
+ * (el anillo avisa por un eventfd registrado en epoll_fd) y en cada
+ * tajada de tiempo (VtimerHandler).  Si io_uring no existe o no
+ * tiene lo necesario, uring_fd queda en -1 y se usa read/write.
+ */
+
+#ifdef USE_IO_URING
+
+#define URING_ENTRIES 256
+
+typedef struct
+{
+  nTask task;   /* La tarea que espera */
+  int res;      /* El resultado de read o write (o -errno) */
+  int done;     /* Verdadero cuando llego la completacion */
+  int parked;   /* Verdadero si la tarea cedio la CPU */
+} UringReq;     /* Vive en el stack de la tarea que espera */
+
+static int uring_fd= -1;
+static int uring_event_fd= -1;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static struct io_uring_sqe *sqes;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+static unsigned uring_entries;  /* Maximo de operaciones en curso */
+static unsigned uring_inflight; /* Operaciones enviadas sin completar */
+static Queue uring_queue;       /* Tareas esperando lugar en el anillo */
+
+static void UringInit()
+{
+  struct io_uring_params p;
+  size_t ring_len, cq_len;
+  char *ring;
+  struct epoll_event ev;
+
+  memset(&p, 0, sizeof(p));
+  uring_fd= syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (uring_fd<0)
+    return;
+
+  /* Se necesita un solo mmap para ambos anillos y poder leer en la
+   * posicion actual del archivo (off==-1), como read y write.
+   */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_RW_CUR_POS))
+    goto fallback;
+
+  ring_len= p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  cq_len= p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  if (cq_len>ring_len) ring_len= cq_len;
+
+  ring= mmap(NULL, ring_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+             uring_fd, IORING_OFF_SQ_RING);
+  if (ring==MAP_FAILED)
+    goto fallback;
+  sqes= mmap(NULL, p.sq_entries*sizeof(struct io_uring_sqe),
+             PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+             uring_fd, IORING_OFF_SQES);
+  if (sqes==MAP_FAILED)
+  {
+    munmap(ring, ring_len);
+    goto fallback;
+  }
+
+  sq_head= (unsigned *)(ring+p.sq_off.head);
+  sq_tail= (unsigned *)(ring+p.sq_off.tail);
+  sq_mask= (unsigned *)(ring+p.sq_off.ring_mask);
+  sq_array= (unsigned *)(ring+p.sq_off.array);
+  cq_head= (unsigned *)(ring+p.cq_off.head);
+  cq_tail= (unsigned *)(ring+p.cq_off.tail);
+  cq_mask= (unsigned *)(ring+p.cq_off.ring_mask);
+  cqes= (struct io_uring_cqe *)(ring+p.cq_off.cqes);
+  uring_entries= p.sq_entries; /* la cola de completaciones es mayor */
+
+  uring_event_fd= eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (uring_event_fd<0 ||
+      syscall(__NR_io_uring_register, uring_fd, IORING_REGISTER_EVENTFD,
+              &uring_event_fd, 1)!=0)
+    nFatalError("UringInit", "No se pudo asociar el eventfd\n");
+
+  ev.events= EPOLLIN | EPOLLET;
+  ev.data.fd= uring_event_fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, uring_event_fd, &ev)!=0)
+    nFatalError("UringInit", "No se pudo registrar el eventfd\n");
+
+  uring_queue= MakeQueue();
+  return;
+
+fallback:
+  close(uring_fd);
+  uring_fd= -1;
+}
+
+/* Solo los archivos abiertos con nOpen van por io_uring.  La entrada
+ * y salida estandar siguen con write aunque sean archivos: muchos
+ * programas hacen nPrintf sin esperar que eso les quite la CPU.
+ */
+
+static void SetFileKind(int fd)
+{
+  struct stat st;
+
+  if (uring_fd<0)
+    return;
+
+  GrowWaits(fd);
+  io_waits[fd].kind= fstat(fd, &st)==0 &&
+                     (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) ?
+                     IO_FILE : IO_POLL;
+}
+
+static int UseUring(int fd)
+{
+  if (uring_fd<0 || fd<0 || fd>=maxsize_waits || io_waits[fd].kind!=IO_FILE)
+    return FALSE;
+
+  /* Solo si la tarea puede ceder la CPU: no en el ciclo de espera de
+   * ResumeNextReadyTask ni a medio bloquearse.  Ahi se usa read/write.
+   */
+  return cpu_status==RUNNING && current_task->status==READY;
+}
+
+/* Envia la operacion op al anillo y espera su completacion.  Si el
+ * anillo esta lleno la tarea espera en uring_queue.  Si la operacion
+ * termino durante io_uring_enter (p.ej. datos en el cache) la tarea
+ * no cede la CPU.  Se invoca dentro de una seccion critica.
+ *
+ * Hay a lo mas una operacion en curso por fd: con off==-1 dos
+ * operaciones simultaneas sobre el mismo archivo compiten por la
+ * posicion actual.  Las demas tareas esperan en io_waits[fd].readers,
+ * en orden de llegada.
+ */
+
+static int UringRW(int op, int fd, char *buf, int nbyte, int status)
+{
+  UringReq req;
+  struct io_uring_sqe *sqe;
+  unsigned tail, index;
+
+  while (io_waits[fd].busy || uring_inflight>=uring_entries)
+  {
+    IOWait *w= &io_waits[fd]; /* io_waits se puede mover con realloc */
+
+    current_task->status= status;
+    if (w->busy)
+    {
+      if (w->readers==NULL) w->readers= MakeQueue();
+      PutTask(w->readers, current_task);
+    }
+    else
+      PutTask(uring_queue, current_task);
+    ResumeNextReadyTask();
+  }
+  io_waits[fd].busy= TRUE;
+
+  req.task= current_task;
+  req.res= 0;
+  req.done= FALSE;
+  req.parked= FALSE;
+
+  tail= *sq_tail;
+  index= tail & *sq_mask;
+  sqe= &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode= op;
+  sqe->fd= fd;
+  sqe->addr= (unsigned long)buf;
+  sqe->len= nbyte;
+  sqe->off= (__u64)-1;  /* la posicion actual, como read y write */
+  sqe->user_data= (unsigned long)&req;
+  sq_array[index]= index;
+  __atomic_store_n(sq_tail, tail+1, __ATOMIC_RELEASE);
+  uring_inflight++;
+
+  while (syscall(__NR_io_uring_enter, uring_fd, 1, 0, 0, NULL, 0)<0)
+    if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+      nFatalError("UringRW", "io_uring_enter fallo (errno %d)\n", errno);
+
+  ReapIO();
+  if (!req.done)
+  {
+    req.parked= TRUE;
+    current_task->status= status;
+    ResumeNextReadyTask(); /* ReapIO la pondra en la ready_queue */
+  }
+
+  io_waits[fd].busy= FALSE;
+  if (io_waits[fd].readers!=NULL && !EmptyQueue(io_waits[fd].readers))
+  {                       /* Le toca a la siguiente tarea de este fd */
+    nTask task= GetTask(io_waits[fd].readers);
+    task->status= READY;
+    PushTask(ready_queue, task);
+  }
+
+  if (req.res<0)
+  {
+    SetErrno(-req.res);
+    return -1;
+  }
+  return req.res;
+}
+
+/* Recoge las completaciones del anillo y despierta a sus tareas.
+ * No se bloquea.  Se invoca dentro de una seccion critica.
+ */
+
+void ReapIO()
+{
+  unsigned head, tail;
+
+  if (uring_fd<0)
+    return;
+
+  head= *cq_head;
+  tail= __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head!=tail)
+  {
+    struct io_uring_cqe *cqe= &cqes[head & *cq_mask];
+    UringReq *req= (UringReq *)(unsigned long)cqe->user_data;
+
+    req->res= cqe->res;
+    req->done= TRUE;
+    if (req->parked)
+    {
+      req->task->status= READY;
+      PushTask(ready_queue, req->task);
+    }
+
+    uring_inflight--;
+    if (!EmptyQueue(uring_queue))
+    {                 /* Hay lugar para la proxima en espera */
+      nTask task= GetTask(uring_queue);
+      task->status= READY;
+      PushTask(ready_queue, task);
+    }
+    head++;
+  }
+
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+#else /* USE_IO_URING */
+
+static void UringInit() { }
+static void SetFileKind(int fd) { }
+static int UseUring(int fd) { return FALSE; }
+static int UringRW(int op, int fd, char *buf, int nbyte, int status)
+{
+  return -1;
+}
+void ReapIO() { }
+
+#endif /* USE_IO_URING */
+
 /*************************************************************
  * AddWaitingTask
  *************************************************************/
 
-/* Este procedimiento agrega una tarea con E/S pendiente al vector
- * pending_fds que necesita la primitiva ``poll''.
- * AddWaitingTask busca un elemento desocupado (pending_fds[i].fd==-1)
- * y lo coloca ahi.  La tarea que origino el requerimiento queda
- * en pending_tasks[i].  La busqueda es circular.
+/* Si fd no cabe en io_waits el vector se agranda al doble (o hasta
+ * fd).  Las colas son punteros, asi que moverlas con realloc no
+ * invalida las tareas que esperan en ellas.
+ */
+
+static void GrowWaits(int fd)
+{
+  int new_size;
+  IOWait *new_waits;
+
+  if (fd<0)
+    nFatalError("GrowWaits", "Descriptor invalido %d\n", fd);
+
+  if (fd<maxsize_waits)
+    return;
+
+  new_size= maxsize_waits*2;
+  if (new_size<=fd) new_size= fd+1;
+  new_waits= (IOWait *) realloc(io_waits, new_size*sizeof(IOWait));
+  if (new_waits==NULL)
+    nFatalError("GrowWaits", "No hay memoria para %d fds\n", new_size);
+  memset(new_waits+maxsize_waits, 0,
+         (new_size-maxsize_waits)*sizeof(IOWait));
+  io_waits= new_waits;
+  maxsize_waits= new_size;
+}
+
+/* Este procedimiento agrega la tarea a la cola de lectores o de
+ * escritores del descriptor, segun su estado (WAIT_READ o WAIT_WRITE).
+ * La primera vez que se espera por un fd, se registra en epoll.
  */
 
 static void AddWaitingTask(int fd, nTask task)
 {
-  pending_tasks[fd]= task;
+  IOWait *w;
+
+  GrowWaits(fd);
+  w= &io_waits[fd];
+
+  if (!w->registered)
+  {
+    struct epoll_event ev;
+    ev.events= EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd= fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)!=0 && errno!=EEXIST)
+      nFatalError("AddWaitingTask", "epoll_ctl fallo para el fd %d\n", fd);
+    w->registered= TRUE;
+  }
+
+  if (task->status==WAIT_READ)
+  {
+    if (w->readers==NULL) w->readers= MakeQueue();
+    PutTask(w->readers, task);
+  }
+  else
+  {
+    if (w->writers==NULL) w->writers= MakeQueue();
+    PutTask(w->writers, task);
+  }
 }
 
 /*************************************************************
- * SigioHandler
+ * Despertar a los workers ociosos (modo M:N)
  *************************************************************/
 
-static struct timeval zero_timeval={0,0};
+/* Un worker sin tareas espera en epoll_pwait como lo hace nSystem con
+ * un solo thread.  Para despertarlo cuando otro worker deja tareas en
+ * su cola ready se escribe en kick_fd, un eventfd registrado en
+ * epoll_fd.  kick_pending evita escribir de nuevo mientras nadie ha
+ * leido el aviso anterior.
+ */
 
-static void SigioHandler()
+static int kick_fd= -1;
+static int kick_pending= FALSE;
+
+void KickInit()
 {
-  int fd;
-  fd_set readfds, writefds;
+  struct epoll_event ev;
 
-  PreemptTask();
+  kick_fd= eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  ev.events= EPOLLIN | EPOLLET;
+  ev.data.fd= kick_fd;
+  if (kick_fd<0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, kick_fd, &ev)!=0)
+    nFatalError("KickInit", "No se pudo crear el eventfd\n");
+}
 
-  FD_ZERO(&readfds);
-  FD_ZERO(&writefds);
+void KickIO()
+{
+  if (!kick_pending)
+  {
+    kick_pending= TRUE;
+    eventfd_write(kick_fd, 1);
+  }
+}
 
-  /* Vemos que descriptores tienen asociada E/S pendiente */
-  for (fd=0; fd<maxsize_pending; fd++) {
-    nTask task= pending_tasks[fd];
+/*************************************************************
+ * AwakeIO, SigioHandler, WaitIO
+ *************************************************************/
+
+/* Pasa a la ready_queue las tareas que esperaban por los eventos que
+ * dejo epoll en events[0..nevents-1].  Un error o un cierre del otro
+ * extremo despierta a lectores y escritores: la llamada a read o
+ * write les entregara el resultado.
+ */
+
+static void AwakeIO(struct epoll_event *events, int nevents)
+{
+  int i;
+
+  for (i=0; i<nevents; i++)
+  {
+    int fd= events[i].data.fd;
+    unsigned int ev= events[i].events;
+    unsigned int hup= EPOLLERR | EPOLLHUP;
+    Queue queue;
+
+#ifdef USE_IO_URING
+    if (fd==uring_event_fd)
+    {                /* Terminaron operaciones de io_uring */
+      eventfd_t count;
+      eventfd_read(uring_event_fd, &count);
+      ReapIO();
+      continue;
+    }
+#endif
 
-    if (task!=NULL) { /* Hay una tarea pendiente para este descriptor */
-      if (task->status==WAIT_READ)
-        FD_SET(fd, &readfds);
-      else if (task->status==WAIT_WRITE)
-        FD_SET(fd, &writefds);
-      else nFatalError("SigioHandler","Bug!\n");
+    if (fd==kick_fd)
+    {                /* Otro worker dejo tareas ready */
+      eventfd_t count;
+      eventfd_read(kick_fd, &count);
+      kick_pending= FALSE;
+      continue;
     }
+
+    if (fd>=maxsize_waits)
+      continue;
+
+    queue= io_waits[fd].readers;
+    if (queue!=NULL && (ev & (EPOLLIN|EPOLLRDHUP|hup)))
+      while (!EmptyQueue(queue))
+      {
+        nTask task= GetTask(queue);
+        task->status= READY;
+        PushTask(ready_queue, task);
+      }
+
+    queue= io_waits[fd].writers;
+    if (queue!=NULL && (ev & (EPOLLOUT|hup)))
+      while (!EmptyQueue(queue))
+      {
+        nTask task= GetTask(queue);
+        task->status= READY;
+        PushTask(ready_queue, task);
+      }
   }
+}
 
-  select(maxsize_pending, &readfds, &writefds, NULL, &zero_timeval);
+/* SIGIO sigue llegando mientras corre una tarea: sin el, una tarea
+ * que calcula sin parar no cederia la CPU a quien acaba de recibir
+ * datos hasta el proximo tic del reloj.  El handler solo recoge los
+ * eventos listos, sin bloquearse.
+ */
 
-  /* Vemos para que descriptores se ha resuelto la E/S pendiente */
+static void SigioHandler()
+{
+  int nevents;
 
-  for (fd=0; fd<maxsize_pending; fd++) {
-    nTask task= pending_tasks[fd];
-    if (task!=NULL &&
-       (FD_ISSET(fd, &readfds) || FD_ISSET(fd, &writefds))) {
-       task->status= READY;
-       PushTask(ready_queue, task);
-       pending_tasks[fd]=NULL; /* Se resolvio ese descriptor */
-       }
-   }
+  PreemptTask();
 
-  SetHandler(SIGIO, SigioHandler);
+  do
+  {
+    nevents= epoll_wait(epoll_fd, events, MAX_EVENTS, 0);
+    if (nevents>0) AwakeIO(events, nevents);
+  } while (nevents==MAX_EVENTS);
 
   ResumePreemptive();
 }
+
+/* Invocado desde WaitSignal cuando no hay tareas ready: se bloquea
+ * en epoll hasta que haya E/S lista o llegue una de las senales que
+ * mask deja pasar.  Reemplaza a sigsuspend.  En modo M:N se suelta
+ * big_lock durante la espera, asi que cada worker recibe los eventos
+ * en su propio arreglo: events[] es de quien tiene el candado.
+ */
+
+static __thread struct epoll_event *worker_events= NULL;
+
+void WaitIO(sigset_t *mask)
+{
+  struct epoll_event *wait_events= events;
+  int nevents;
+
+  if (epoll_fd<0)
+  {
+    sigsuspend(mask);
+    return;
+  }
+
+  if (workers>1)
+  {
+    if (worker_events==NULL)
+      worker_events= (struct epoll_event *)
+                     nMalloc(MAX_EVENTS*sizeof(struct epoll_event));
+    wait_events= worker_events;
+    UnlockWorkers();
+  }
+  nevents= epoll_pwait(epoll_fd, wait_events, MAX_EVENTS, -1, mask);
+  if (workers>1)
+    LockWorkers();
+  if (nevents>0)
+    AwakeIO(wait_events, nevents);
+}
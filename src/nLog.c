@@ -0,0 +1,180 @@
+#include "nSysimp.h"
+#include "nSystem.h"
+#include "nLog.h"
+#include <unistd.h>
+
+/*************************************************************
+ * Log binario
+ *************************************************************/
+
+/* LOG anota registros de taman~o fijo en un anillo en memoria, sin
+ * formatear nada ni hacer E/S.  Una tarea del sistema los escribe en
+ * el archivo de log con nWrite cuando el anillo llega a la mitad, y
+ * LogEnd escribe lo que quede al terminar el proceso.  Si el anillo se
+ * llena los registros nuevos se descartan y se cuentan.  El programa
+ * nlogdump (nLogDump.c) traduce el archivo a texto.
+ */
+
+#define LOG_RING 4096  /* Nro. de registros del anillo (potencia de 2) */
+
+int log_level= NLOG_NONE;
+static int wanted_level= NLOG_DEBUG; /* El de nSetLogLevel */
+static int log_fd= -1;
+
+static LogRecord ring[LOG_RING];
+static unsigned head= 0;    /* Proximo registro por anotar */
+static unsigned claimed= 0; /* Proximo registro que nadie esta escribiendo */
+static unsigned written= 0; /* Los anteriores ya estan en el archivo */
+static int dropped= 0;
+static nTask drain_task= NULL;
+static int draining= FALSE;      /* La tarea del log esta en nWrite */
+static Queue flush_queue= NULL;  /* Los nSetLogFile que esperan que salga */
+
+void LogRecordEvent(int event, long a, long b, long c)
+{
+  LogRecord *rec;
+
+  START_CRITICAL();
+  if (head-written==LOG_RING)
+    dropped++;
+  else
+  {
+    rec= &ring[head%LOG_RING];
+    rec->time= nGetTime();
+    rec->event= event;
+    rec->task= (long)current_task;
+    rec->args[0]= a;
+    rec->args[1]= b;
+    rec->args[2]= c;
+    head++;
+    if (head-claimed>=LOG_RING/2 && drain_task->status==WAIT_LOG)
+    {
+      drain_task->status= READY;
+      PutTask(ready_queue, drain_task);
+    }
+  }
+  END_CRITICAL();
+}
+
+/* Escribe los registros del anillo desde claimed, sin pasar del final
+ * del arreglo.  Mientras write_fn escribe (nWrite puede ceder la CPU)
+ * LogRecordEvent no sobrescribe esos registros, porque no pasa de
+ * written.  Retorna falso si no habia nada.
+ */
+
+static int WriteRing(int (*write_fn)(int, char *, int))
+{
+  unsigned begin= claimed, end= head;
+  int n;
+
+  if (end==begin)
+    return FALSE;
+  if (end/LOG_RING!=begin/LOG_RING)
+    end= (begin/LOG_RING+1)*LOG_RING; /* Hasta el final del arreglo */
+  claimed= end;
+  n= (end-begin)*sizeof(LogRecord);
+  if ((*write_fn)(log_fd, (char *)&ring[begin%LOG_RING], n)!=n)
+    log_level= NLOG_NONE; /* Sin donde escribir no vale la pena anotar */
+  written= end;
+  return TRUE;
+}
+
+static int RawWrite(int fd, char *buf, int n)
+{
+  return write(fd, buf, n);
+}
+
+/* La tarea del log: duerme en WAIT_LOG hasta que el anillo llega a la
+ * mitad.  Mientras escribe marca draining, para que nSetLogFile no
+ * escriba registros posteriores antes que los suyos.
+ */
+
+static int LogDrain()
+{
+  nTask task;
+
+  nSetTaskName("log");
+  for (;;)
+  {
+    START_CRITICAL();
+    while (head==claimed)
+    {
+      current_task->status= WAIT_LOG;
+      ResumeNextReadyTask();
+    }
+    draining= TRUE;
+    END_CRITICAL();
+    WriteRing(nWrite);
+    START_CRITICAL();
+    draining= FALSE;
+    while ((task= GetTask(flush_queue))!=NULL)
+    {
+      task->status= READY;
+      PutTask(ready_queue, task);
+    }
+    END_CRITICAL();
+  }
+  return 0;
+}
+
+/* Fija el archivo de log (fd<0 lo desactiva) y retorna el anterior */
+
+int nSetLogFile(int fd)
+{
+  int prev;
+
+  if (fd>=0 && drain_task==NULL)
+  {
+    flush_queue= MakeQueue();
+    drain_task= nEmitTask(LogDrain);
+  }
+
+  START_CRITICAL();
+  /* Si la tarea del log esta escribiendo hay que esperarla: lo que
+   * quede en el anillo es posterior a lo que ella escribe.
+   */
+  while (draining)
+  {
+    current_task->status= WAIT_LOG;
+    PutTask(flush_queue, current_task);
+    ResumeNextReadyTask();
+  }
+  prev= log_fd;
+  while (WriteRing(RawWrite))
+    ;
+  log_fd= fd;
+  log_level= fd<0 ? NLOG_NONE : wanted_level;
+  END_CRITICAL();
+
+  return prev;
+}
+
+/* Fija el nivel maximo de los eventos que se anotan y retorna el anterior */
+
+int nSetLogLevel(int level)
+{
+  int prev;
+
+  START_CRITICAL();
+  prev= wanted_level;
+  wanted_level= level;
+  if (log_fd>=0)
+    log_level= level;
+  END_CRITICAL();
+
+  return prev;
+}
+
+/* Al terminar el proceso: si la tarea del log estaba a medio escribir
+ * con io_uring, esos registros se pierden.
+ */
+
+void LogEnd()
+{
+  if (log_fd<0)
+    return;
+  while (WriteRing(RawWrite))
+    ;
+  if (dropped>0)
+    nFprintf(2, "Registros descartados del log: %d\n", dropped);
+}
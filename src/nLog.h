@@ -0,0 +1,45 @@
+/*************************************************************
+ * nLog.c: log binario de bajo costo
+ *************************************************************/
+
+/* LOG(EVENTO, a, b, c) anota un registro binario en un anillo en
+ * memoria que vacia la tarea del log (ver nLog.c).  Cada evento tiene
+ * un nivel (ver nLogEvents.h).  Los eventos con nivel mayor que
+ * LOG_LEVEL no se compilan; los demas cuestan una comparacion si su
+ * nivel es mayor que el fijado con nSetLogLevel o no hay archivo de log.
+ * Compile con -DLOG_LEVEL=NLOG_INFO para eliminar los de depuracion.
+ */
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL NLOG_DEBUG
+#endif
+
+#define LOG_EVENT(name, level, format) LOG_##name,
+enum { LOG_EVENTS_BEGIN= -1,
+#include "nLogEvents.h"
+       LOG_EVENTS_END };
+#undef LOG_EVENT
+
+#define LOG_EVENT(name, level, format) LOG_LEVEL_##name= level,
+enum {
+#include "nLogEvents.h"
+       LOG_LEVELS_END };
+#undef LOG_EVENT
+
+typedef struct LogRecord
+{
+  int time;          /* nGetTime() */
+  int event;         /* LOG_<nombre> */
+  long task;         /* La tarea que lo anoto */
+  long args[3];
+} LogRecord;
+
+extern int log_level;  /* NLOG_NONE si no hay archivo de log */
+
+void LogRecordEvent(int event, long a, long b, long c);
+
+#define LOG(name, a, b, c) \
+  do { \
+    if (LOG_LEVEL_##name<=LOG_LEVEL && LOG_LEVEL_##name<=log_level) \
+      LogRecordEvent(LOG_##name, (long)(a), (long)(b), (long)(c)); \
+  } while (0)
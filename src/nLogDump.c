@@ -0,0 +1,45 @@
+/* nlogdump: traduce a texto un archivo del log binario de nSystem
+ * (ver nLog.c).  Uso: nlogdump archivo-de-log
+ * Es un programa Unix comun, no usa nSystem.
+ */
+
+#include <stdio.h>
+#include "nSystem.h"
+#include "nLog.h"
+
+#define LOG_EVENT(name, level, format) { #name, format },
+static struct { char *name; char *format; } events[]= {
+#include "nLogEvents.h"
+};
+#undef LOG_EVENT
+
+int main(int argc, char **argv)
+{
+  FILE *in;
+  LogRecord rec;
+
+  if (argc!=2)
+  {
+    fprintf(stderr, "uso: %s archivo-de-log\n", argv[0]);
+    return 1;
+  }
+  in= fopen(argv[1], "rb");
+  if (in==NULL)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, in)==1)
+  {
+    printf("%8d ", rec.time);
+    if (rec.event<0 || rec.event>=LOG_EVENTS_END)
+      printf("%lx evento desconocido %d\n", rec.task, rec.event);
+    else
+      printf(events[rec.event].format, rec.task,
+             rec.args[0], rec.args[1], rec.args[2]);
+  }
+
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,22 @@
+/*************************************************************
+ * Eventos del log binario (ver nLog.c)
+ *************************************************************/
+
+/* LOG_EVENT(nombre, nivel, formato): el formato lo usa solo el
+ * decodificador (nlogdump) y recibe la tarea y los 3 argumentos del
+ * registro, todos como long.  Agregue los eventos nuevos al final para
+ * que los logs antiguos se sigan decodificando.
+ */
+
+LOG_EVENT(SHARE_BEGIN, NLOG_DEBUG, "%lx nShare: share %lx publica %lx\n")
+LOG_EVENT(SHARE_END, NLOG_DEBUG, "%lx nShare: share %lx termina de compartir %lx\n")
+LOG_EVENT(REQUEST_HIT, NLOG_DEBUG, "%lx nRequest: share %lx entrega %lx\n")
+LOG_EVENT(REQUEST_FRESH, NLOG_DEBUG,
+          "%lx nRequestFresh: share %lx entrega %lx, compartido hace %ld ms\n")
+LOG_EVENT(REQUEST_WAIT, NLOG_DEBUG, "%lx nRequest: espera share %lx, timeout %ld\n")
+LOG_EVENT(REQUEST_ANSWER, NLOG_DEBUG, "%lx nRequest: share %lx respondio %lx\n")
+LOG_EVENT(REQUEST_TIMEOUT, NLOG_INFO, "%lx nRequest: share %lx no respondio en %ld ms\n")
+LOG_EVENT(RELEASE, NLOG_DEBUG, "%lx nRelease: share %lx, quedan %ld\n")
+LOG_EVENT(RELEASE_WAKE, NLOG_DEBUG, "%lx nRelease: share %lx despierta a %lx\n")
+LOG_EVENT(RELEASE_UNMATCHED, NLOG_WARN, "%lx nRelease: share %lx no le entrego nada\n")
+LOG_EVENT(LEASE_EXPIRED, NLOG_INFO, "%lx plazo vencido: share %lx libera %lx\n")
@@ -39,6 +39,14 @@ int main(int argc, char **argv)
             nFatalError("main", "Invalid option -slice %s", argv[in]);
         nSetTimeSlice(atoi(argv[in]));
       }
+      else if (strcmp(argv[in], "-workers") == 0 && ++in < argc)
+      {
+        char *pc;
+        for (pc = argv[in]; *pc != '\0'; pc++)
+          if (!('0' <= *pc && *pc <= '9'))
+            nFatalError("main", "Invalid option -workers %s", argv[in]);
+        nSetWorkers(atoi(argv[in]));
+      }
       else if (strcmp(argv[in], "-noblocking") == 0)
         nSetNonBlockingStdio();
       else
@@ -64,6 +72,7 @@ void nExitSystem(int rc)
   MsgEnd();
   TimeEnd();
   IOEnd();
+  LogEnd();
 
   exit(rc);
 }
@@ -12,7 +12,7 @@ typedef struct
 typedef struct
 {
   nMonitor mon;
-  FifoQueue wqueue;
+  Queue wqueue; /* Intrusiva: el timeout saca a la tarea (ver nTime.c) */
 }
   *nCondition;
 
@@ -21,7 +21,7 @@ typedef struct
 #include <nSystem.h>
 #include <stdio.h>
 
-static void ReadyFirstTask(Queue queue);
+static void HandOff(nMonitor mon);
 
 nMonitor nMakeMonitor()
 {
@@ -57,18 +57,68 @@ void nEnter(nMonitor mon)
   END_CRITICAL();
 }
 
+/* Como nEnter, pero espera a lo mas timeout milisegundos (<0 es
+ * indefinidamente, 0 no espera).  Retorna verdadero si obtuvo el
+ * monitor y falso si vencio el timeout.
+ */
+
+int nEnterTimeout(nMonitor mon, int timeout)
+{
+  int ok= TRUE;
+
+  START_CRITICAL();
+
+  if (mon->owner==current_task)
+    nFatalError("nEnterTimeout", "Trying to own the same monitor twice\n");
+
+  if (mon->owner==NULL)
+    mon->owner= current_task;
+  else if (timeout==0)
+    ok= FALSE;
+  else
+  {
+    if (timeout>0)
+    {
+      current_task->status= WAIT_MON_TIMEOUT;
+      ProgramQueueTask(timeout);
+    }
+    else
+      current_task->status= WAIT_MON;
+    PutTask(mon->mqueue, current_task);
+    ResumeNextReadyTask(); /* HandOff ya le entrego el monitor */
+    ok= timeout<0 || !current_task->timed_out;
+  }
+
+  END_CRITICAL();
+
+  return ok;
+}
+
+int nTryEnter(nMonitor mon)
+{
+  return nEnterTimeout(mon, 0);
+}
+
 void nExit(nMonitor mon)
 {
   START_CRITICAL();
 
   if (mon->owner!=current_task)
     nFatalError("nExit", "This thread does not own this monitor\n");
-  mon->owner= NULL;
 
-  PushTask(ready_queue, current_task);
-  ReadyFirstTask(mon->mqueue);
-  ResumeNextReadyTask();
-  
+  /* Sin tareas esperando basta con liberar el monitor: no hay cambio
+   * de contexto.  Si hay alguna, se le entrega el monitor y se le
+   * cede la CPU como antes.
+   */
+  if (EmptyQueue(mon->mqueue))
+    mon->owner= NULL;
+  else
+  {
+    PushTask(ready_queue, current_task);
+    HandOff(mon);
+    ResumeNextReadyTask();
+  }
+
   END_CRITICAL();
 }
 
@@ -78,10 +128,9 @@ void nWait(nMonitor mon)
 
   if (mon->owner!=current_task)
     nFatalError("nWait", "This thread does not own this monitor\n");
-  mon->owner= NULL;
   current_task->status= WAIT_COND;
   PutObj(mon->wqueue, current_task);
-  ReadyFirstTask(mon->mqueue);
+  HandOff(mon);
   ResumeNextReadyTask();
 
   mon->owner= current_task;
@@ -110,32 +159,68 @@ nCondition nMakeCondition(nMonitor mon)
 {
   nCondition cond= (nCondition)nMalloc(sizeof(*cond));
   cond->mon= mon;
-  cond->wqueue= MakeFifoQueue();
+  cond->wqueue= MakeQueue();
   return cond;
 }
 
 void nDestroyCondition(nCondition cond)
 {
-  DestroyFifoQueue(cond->wqueue);
+  DestroyQueue(cond->wqueue);
   nFree(cond);
 }
 
 void nWaitCondition(nCondition cond)
 {
+  nWaitConditionTimeout(cond, -1);
+}
+
+/* Como nWaitCondition, pero espera a lo mas timeout milisegundos (<0
+ * es indefinidamente, 0 no espera).  En ambos casos retorna con el
+ * monitor: si vencio el timeout primero vuelve a entrar.  Retorna
+ * falso si vencio el timeout.
+ */
+
+int nWaitConditionTimeout(nCondition cond, int timeout)
+{
+  nMonitor mon= cond->mon;
+  int ok= TRUE;
+
   START_CRITICAL();
 
-  if (cond->mon->owner!=current_task)
-    nFatalError("nNotifyAll", "This thread does not own this monitor\n");
+  if (mon->owner!=current_task)
+    nFatalError("nWaitCondition", "This thread does not own this monitor\n");
 
-  cond->mon->owner= NULL;
-  current_task->status= WAIT_COND;
-  PutObj(cond->wqueue, current_task);
-  ReadyFirstTask(cond->mon->mqueue);
-  ResumeNextReadyTask();
+  if (timeout==0)
+    ok= FALSE;
+  else
+  {
+    if (timeout>0)
+    {
+      current_task->status= WAIT_COND_TIMEOUT;
+      ProgramQueueTask(timeout);
+    }
+    else
+      current_task->status= WAIT_COND;
+    PutTask(cond->wqueue, current_task);
+    HandOff(mon);
+    ResumeNextReadyTask();
 
-  cond->mon->owner= current_task;
+    if (timeout>0 && current_task->timed_out)
+    {
+      ok= FALSE;
+      if (mon->owner!=NULL)
+      { /* Espera su turno para volver a entrar */
+        current_task->status= WAIT_MON;
+        PutTask(mon->mqueue, current_task);
+        ResumeNextReadyTask();
+      }
+    }
+    mon->owner= current_task;
+  }
 
   END_CRITICAL();
+
+  return ok;
 }
 
 void nSignalCondition(nCondition cond)
@@ -146,9 +231,11 @@ void nSignalCondition(nCondition cond)
   if (cond->mon->owner!=current_task)
     nFatalError("nSignalCondition", "This thread does not own this monitor\n");
 
-  task= (nTask)GetObj(cond->wqueue);
+  task= GetTask(cond->wqueue);
   if (task!=NULL)
   {
+    if (task->status==WAIT_COND_TIMEOUT)
+      CancelTask(task);
     task->status= WAIT_MON;
     PushTask(cond->mon->mqueue, task);
   }
@@ -156,11 +243,18 @@ void nSignalCondition(nCondition cond)
   END_CRITICAL();
 }
 
-static void ReadyFirstTask(Queue queue)
+/* Entrega el monitor a la primera tarea en espera de entrar, que
+ * queda primera en la cola ready.  Si no hay ninguna queda libre.
+ */
+
+static void HandOff(nMonitor mon)
 {
-  nTask task= GetTask(queue);
+  nTask task= GetTask(mon->mqueue);
+  mon->owner= task;
   if (task!=NULL)
   {
+    if (task->status==WAIT_MON_TIMEOUT)
+      CancelTask(task);
     task->status= READY;
     PushTask(ready_queue, task);
 } }
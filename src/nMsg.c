@@ -1,28 +1,48 @@
 #include "nSysimp.h"
 #include "nSystem.h"
 
+static void *GetMessage(nTask this_task, nTask *ptask);
+static void *ReceiveMessage(nTask reply_to, nTask *ptask, int timeout);
+
 /*************************************************************
  * Epilogo
  *************************************************************/
 
 static int pending_sends = 0;
 static int pending_receives = 0;
+static int pending_posts = 0;
 
 void MsgEnd()
 {
-  if (pending_sends != 0 || pending_receives != 0)
+  if (pending_sends != 0 || pending_receives != 0 || pending_posts != 0)
   {
     nFprintf(2, "\nNro. de tareas bloqueadas en un nSend: %d\n",
              pending_sends);
     nFprintf(2, "Nro. de tareas bloqueadas en un nReceive: %d\n",
              pending_receives);
+    nFprintf(2, "Nro. de tareas bloqueadas en un nPost: %d\n",
+             pending_posts);
   }
 }
 
 /*************************************************************
- * nSend, nReceive y nReply
+ * nSend, nReceive, nReply y nReplyAndReceive
  *************************************************************/
 
+/* El buzon de una tarea (ver nPost mas abajo) */
+typedef struct Mailbox
+{
+  int size;      /* Capacidad del anillo */
+  int head;      /* Indice del mensaje mas antiguo */
+  int count;     /* Nro. de mensajes en el anillo */
+  Queue posters; /* Tareas en nPost esperando espacio */
+  struct
+  {
+    void *msg;
+    unsigned seq; /* Nro. de llegada al receptor */
+  } slots[1];    /* En realidad son size */
+} Mailbox;
+
 int nSend(nTask task, void *msg)
 {
   int rc;
@@ -32,21 +52,24 @@ int nSend(nTask task, void *msg)
   {
     nTask this_task = current_task;
 
-    if (task->status == WAIT_SEND || task->status == WAIT_SEND_TIMEOUT)
-    {
-      if (task->status == WAIT_SEND_TIMEOUT)
-        CancelTask(task);
-      task->status = READY;
-      PushTask(ready_queue, task); /* En primer lugar en la cola */
-    }
-    else if (task->status == ZOMBIE)
+    if (task->status == ZOMBIE)
       nFatalError("nSend", "El receptor es un ``zombie''\n");
 
     /* En nReply se coloca ``this_task'' en la cola de tareas ready */
     PutTask(task->send_queue, this_task);
     this_task->send.msg = msg;
+    this_task->send_seq = task->arrivals++;
     this_task->status = WAIT_REPLY;
-    ResumeNextReadyTask();
+
+    if (task->status == WAIT_SEND || task->status == WAIT_SEND_TIMEOUT)
+    {
+      if (task->status == WAIT_SEND_TIMEOUT)
+        CancelTask(task);
+      task->status = READY;
+      SwitchToTask(task); /* El receptor corre de inmediato */
+    }
+    else
+      ResumeNextReadyTask();
 
     rc = this_task->send.rc;
   }
@@ -56,35 +79,67 @@ int nSend(nTask task, void *msg)
   return rc;
 }
 
-void *nReceive(nTask *ptask, int timeout)
+/* Como nSend, pero si el receptor no recibe el mensaje dentro de
+ * timeout milisegundos lo retira y retorna falso (<0 es
+ * indefinidamente, con 0 solo se envia si el receptor espera en un
+ * nReceive).  Una vez recibido el mensaje se espera el nReply
+ * sin limite, ya que el receptor lo va a responder.  Retorna
+ * verdadero y el codigo del nReply en *prc.
+ */
+
+int nSendTimeout(nTask task, void *msg, int timeout, int *prc)
 {
-  void *msg;
-  nTask send_task;
+  nTask this_task = current_task;
+  int ok = TRUE;
 
   START_CRITICAL();
-  pending_receives++;
+
+  if (task->status == ZOMBIE)
+    nFatalError("nSendTimeout", "El receptor es un ``zombie''\n");
+
+  if (timeout < 0 || (timeout == 0 && (task->status == WAIT_SEND ||
+                                        task->status == WAIT_SEND_TIMEOUT)))
+    *prc = nSend(task, msg);
+  else if (timeout == 0)
+    ok = FALSE;
+  else
   {
-    nTask this_task = current_task;
+    pending_sends++;
+    PutTask(task->send_queue, this_task);
+    this_task->send.msg = msg;
+    this_task->send_seq = task->arrivals++;
+    this_task->status = WAIT_REPLY_TIMEOUT;
+    ProgramQueueTask(timeout); /* GetMessage lo anula */
 
-    if (EmptyQueue(this_task->send_queue) && timeout != 0)
+    if (task->status == WAIT_SEND || task->status == WAIT_SEND_TIMEOUT)
     {
-      if (timeout > 0)
-      {
-        this_task->status = WAIT_SEND_TIMEOUT;
-        ProgramTask(timeout);
-        /* La tarea se despertara automaticamente despues de timeout */
-      }
-      else
-        this_task->status = WAIT_SEND; /* La tarea espera indefinidamente */
-
-      ResumeNextReadyTask(); /* Se suspende indefinidamente hasta un nSend */
+      if (task->status == WAIT_SEND_TIMEOUT)
+        CancelTask(task);
+      task->status = READY;
+      SwitchToTask(task);
     }
+    else
+      ResumeNextReadyTask();
 
-    send_task = GetTask(this_task->send_queue);
-    if (ptask != NULL)
-      *ptask = send_task;
-    msg = send_task == NULL ? NULL : send_task->send.msg;
+    if (this_task->timed_out)
+      ok = FALSE;
+    else
+      *prc = this_task->send.rc;
+    pending_sends--;
   }
+
+  END_CRITICAL();
+
+  return ok;
+}
+
+void *nReceive(nTask *ptask, int timeout)
+{
+  void *msg;
+
+  START_CRITICAL();
+  pending_receives++;
+  msg = ReceiveMessage(NULL, ptask, timeout);
   pending_receives--;
   END_CRITICAL();
 
@@ -98,13 +153,237 @@ void nReply(nTask task, int rc)
   if (task->status != WAIT_REPLY)
     nFatalError("nReply", "Esta tarea no espera un ``nReply''\n");
 
-  PushTask(ready_queue, current_task);
-
   task->send.rc = rc;
-  task->status = READY;
-  PushTask(ready_queue, task);
+  WakeTask(task, wake_policy);
+
+  END_CRITICAL();
+}
+
+/* nReplyAndReceive responde a reply_to (si no es NULL) y espera el
+ * siguiente mensaje, todo en una sola seccion critica.  Si hay que
+ * esperar, la CPU pasa directamente al cliente que recibio la
+ * respuesta, sin pasar por la cola ready; si ya hay un mensaje, el
+ * servidor sigue corriendo y el cliente queda primero en la cola.
+ * Un servidor tipico queda:
+ *
+ *   nTask client = NULL;
+ *   for (;;)
+ *   {
+ *     Request *req = nReplyAndReceive(client, rc, &client, -1);
+ *     ... rc = ...
+ *   }
+ */
+
+void *nReplyAndReceive(nTask reply_to, int rc, nTask *ptask, int timeout)
+{
+  void *msg;
+
+  START_CRITICAL();
+
+  if (reply_to != NULL)
+  {
+    if (reply_to->status != WAIT_REPLY)
+      nFatalError("nReplyAndReceive",
+                  "Esta tarea no espera un ``nReply''\n");
+    reply_to->send.rc = rc;
+    reply_to->status = READY;
+  }
+
+  pending_receives++;
+  msg = ReceiveMessage(reply_to, ptask, timeout);
+  pending_receives--;
+
+  END_CRITICAL();
+
+  return msg;
+}
+
+/* Espera hasta timeout milisegundos un mensaje para la tarea actual
+ * y lo extrae.  Si reply_to no es NULL es una tarea READY que no esta
+ * en ninguna cola: si hay que esperar se le cede la CPU directamente,
+ * y si no, se coloca primera en la cola ready.  Se invoca en una
+ * seccion critica.
+ */
+
+static void *ReceiveMessage(nTask reply_to, nTask *ptask, int timeout)
+{
+  nTask this_task = current_task;
+  struct Mailbox *mb = this_task->mailbox;
 
-  ResumeNextReadyTask();
+  if (EmptyQueue(this_task->send_queue) &&
+      (mb == NULL || mb->count == 0) && timeout != 0)
+  {
+    if (timeout > 0)
+    {
+      this_task->status = WAIT_SEND_TIMEOUT;
+      ProgramTask(timeout);
+      /* La tarea se despertara automaticamente despues de timeout */
+    }
+    else
+      this_task->status = WAIT_SEND; /* La tarea espera indefinidamente */
+
+    if (reply_to != NULL)
+      SwitchToTask(reply_to);
+    else
+      ResumeNextReadyTask(); /* Se suspende hasta un nSend o nPost */
+  }
+  else if (reply_to != NULL)
+    PushTask(ready_queue, reply_to);
+
+  return GetMessage(this_task, ptask);
+}
+
+/*************************************************************
+ * nPost y los buzones
+ *************************************************************/
+
+/* Ademas de la cola de emisores, cada tarea puede tener un buzon: un
+ * anillo acotado con los mensajes enviados por nPost, que no esperan
+ * nReply.  Cada mensaje, sea de nSend o de nPost, recibe un numero de
+ * llegada del receptor, y nReceive entrega el mas antiguo de los dos.
+ * El buzon se crea con el primer nPost dirigido a la tarea.
+ */
+
+static int mailbox_size = 64;
+
+int nSetMailboxSize(int size)
+{
+  int old_size = mailbox_size;
+
+  if (size <= 0)
+    nFatalError("nSetMailboxSize", "El taman~o debe ser positivo\n");
+  mailbox_size = size; /* rige para los buzones que se creen despues */
+
+  return old_size;
+}
+
+static Mailbox *MakeMailbox(int size)
+{
+  Mailbox *mb = (Mailbox *)nMalloc(sizeof(Mailbox) +
+                                   (size - 1) * sizeof(mb->slots[0]));
+  mb->size = size;
+  mb->head = 0;
+  mb->count = 0;
+  mb->posters = MakeQueue();
+
+  return mb;
+}
+
+void DestroyMailbox(nTask task)
+{
+  Mailbox *mb = task->mailbox;
+
+  if (mb == NULL)
+    return;
+  if (!EmptyQueue(mb->posters))
+    nFatalError("nWaitTask",
+                "Hay %d tarea(s) en nPost hacia la tarea moribunda\n",
+                QueueLength(mb->posters));
+  DestroyQueue(mb->posters);
+  nFree(mb);
+  task->mailbox = NULL;
+}
+
+/* nPost deposita msg en el buzon de task y retorna 0 sin ceder la
+ * CPU: el receptor, si esperaba en nReceive, queda al final de la
+ * cola ready.  El area apuntada por msg no puede estar en la pila del
+ * emisor, ya que este sigue corriendo.  Si el buzon esta lleno y wait
+ * es verdadero, el emisor espera a que nReceive libere un lugar; si
+ * wait es falso, nPost retorna -1.
+ */
+
+int nPost(nTask task, void *msg, int wait)
+{
+  int rc = 0;
+  Mailbox *mb;
+
+  START_CRITICAL();
+
+  if (task->mailbox == NULL)
+    task->mailbox = MakeMailbox(mailbox_size);
+  mb = task->mailbox;
+
+  for (;;)
+  {
+    if (task->status == ZOMBIE)
+      nFatalError("nPost", "El receptor es un ``zombie''\n");
+    if (mb->count < mb->size)
+      break;
+    if (!wait || task == current_task)
+    {
+      rc = -1; /* Buzon lleno (esperar por si mismo seria un deadlock) */
+      break;
+    }
+
+    pending_posts++;
+    current_task->status = WAIT_POST;
+    PutTask(mb->posters, current_task);
+    ResumeNextReadyTask(); /* Vuelve cuando nReceive saca un mensaje */
+    pending_posts--;
+  }
+
+  if (rc == 0)
+  {
+    int tail = (mb->head + mb->count) % mb->size;
+    mb->slots[tail].msg = msg;
+    mb->slots[tail].seq = task->arrivals++;
+    mb->count++;
+
+    if (task->status == WAIT_SEND || task->status == WAIT_SEND_TIMEOUT)
+    {
+      if (task->status == WAIT_SEND_TIMEOUT)
+        CancelTask(task);
+      task->status = READY;
+      PutTask(ready_queue, task); /* El emisor sigue con la CPU */
+    }
+  }
 
   END_CRITICAL();
+
+  return rc;
+}
+
+/* Extrae el mensaje que llego primero, ya sea de la cola de emisores
+ * o del buzon.  *ptask queda con el emisor, o NULL si el mensaje
+ * vino de nPost o si no hay mensajes.  Se invoca en una seccion
+ * critica.
+ */
+
+static void *GetMessage(nTask this_task, nTask *ptask)
+{
+  Mailbox *mb = this_task->mailbox;
+  nTask send_task = this_task->send_queue->first;
+  void *msg;
+
+  if (mb != NULL && mb->count > 0 &&
+      (send_task == NULL ||
+       (int)(mb->slots[mb->head].seq - send_task->send_seq) < 0))
+  {
+    msg = mb->slots[mb->head].msg;
+    mb->head = (mb->head + 1) % mb->size;
+    mb->count--;
+    send_task = NULL;
+
+    if (!EmptyQueue(mb->posters))
+    { /* Ahora hay espacio para un emisor bloqueado en nPost */
+      nTask poster = GetTask(mb->posters);
+      poster->status = READY;
+      PutTask(ready_queue, poster);
+    }
+  }
+  else
+  {
+    send_task = GetTask(this_task->send_queue);
+    msg = send_task == NULL ? NULL : send_task->send.msg;
+    if (send_task != NULL && send_task->status == WAIT_REPLY_TIMEOUT)
+    { /* Ya no puede retirar el mensaje: espera el nReply */
+      CancelTask(send_task);
+      send_task->status = WAIT_REPLY;
+    }
+  }
+
+  if (ptask != NULL)
+    *ptask = send_task;
+
+  return msg;
 }
@@ -115,6 +115,53 @@ void nFree(void *ptr)
   END_CRITICAL();
 }
 
+/*************************************************************
+ * Slabs
+ *************************************************************/
+
+/* Se pide memoria por bloques de SLAB_CHUNK bytes (al menos 4 objetos)
+ * que se cortan en objetos del taman~o del cache.  Los objetos libres
+ * forman una lista encadenada a traves de su primera palabra.
+ */
+
+#define SLAB_CHUNK (16*1024)
+
+void *SlabAlloc(SlabCache *cache)
+{
+  void *obj;
+
+  START_CRITICAL();
+
+  if (cache->free_list==NULL)
+  {
+    int chunk= cache->size*4>SLAB_CHUNK ? cache->size*4 : SLAB_CHUNK;
+    char *block, *p;
+
+    if (posix_memalign((void **)&block, cache->align, chunk)!=0)
+      nFatalError("SlabAlloc", "Se acabo la memoria\n");
+    for (p= block; p+cache->size<=block+chunk; p+= cache->size)
+    {
+      *(void **)p= cache->free_list;
+      cache->free_list= p;
+    }
+  }
+
+  obj= cache->free_list;
+  cache->free_list= *(void **)obj;
+
+  END_CRITICAL();
+
+  return obj;
+}
+
+void SlabFree(SlabCache *cache, void *obj)
+{
+  START_CRITICAL();
+    *(void **)obj= cache->free_list;
+    cache->free_list= obj;
+  END_CRITICAL();
+}
+
 /*************************************************************
  * nPrintf, nFprintf
  *************************************************************/
@@ -201,3 +248,133 @@ void CheckStack(SP sp)
       if (sp[ADDRMAGIC1] != MAGIC1 || sp[ADDRMAGIC2] != MAGIC2 )
         nFatalError("ChechStack", "Desorde de pila\n");
 }
+
+/*************************************************************
+ * Pool de pilas con pagina de guardia
+ *************************************************************/
+
+/* Cada pila es una region obtenida con mmap, precedida por una pagina
+ * sin permisos.  Un desborde produce un SIGSEGV inmediato en vez de
+ * corromper la memoria vecina.  El handler corre en un stack alternativo
+ * (la pila de la tarea esta agotada) e informa que tarea se desbordo.
+ *   Las pilas liberadas se guardan en un pool (LIFO) y se reutilizan sin
+ * limpiarlas.  Si las pilas en el pool superan STACK_POOL_HIGHWATER bytes,
+ * sus paginas se devuelven al sistema con MADV_DONTNEED (la region queda
+ * reservada para el proximo AllocStack).
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define STACK_POOL_HIGHWATER (8*1024*1024)
+#define ALTSTACK_SIZE (64*1024)
+
+typedef struct PooledStack
+{
+  struct PooledStack *next;
+  int size;
+  int resident; /* Bytes que cuenta pool_resident */
+}
+  PooledStack;
+
+static PooledStack *stack_pool= NULL; /* Pilas libres */
+static int pool_resident= 0; /* Bytes del pool que no se han devuelto */
+static int page_size;
+
+static void StackSegvHandler(int sig, siginfo_t *info, void *context);
+
+void StackInit()
+{
+  struct sigaction Action;
+
+  page_size= sysconf(_SC_PAGESIZE);
+
+  AltStackInit();
+
+  /* No pasa por SetHandler: un SIGSEGV no se puede diferir */
+  Action.sa_sigaction= StackSegvHandler;
+  sigemptyset(&Action.sa_mask);
+  Action.sa_flags= SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+  sigaction(SIGSEGV, &Action, NULL);
+}
+
+/* El stack alternativo es propio de cada thread: en modo M:N cada
+ * worker invoca AltStackInit al partir.
+ */
+
+void AltStackInit()
+{
+  stack_t altstack;
+
+  altstack.ss_sp= malloc(ALTSTACK_SIZE);
+  if (altstack.ss_sp==NULL) nFatalError("AltStackInit", "Se acabo la memoria\n");
+  altstack.ss_size= ALTSTACK_SIZE;
+  altstack.ss_flags= 0;
+  sigaltstack(&altstack, NULL);
+}
+
+SP AllocStack(int size)
+{
+  PooledStack **ppooled;
+  char *region;
+
+  size= (size+page_size-1) & -page_size;
+
+  /* Normalmente todas las pilas son del mismo taman~o: la primera sirve */
+  for (ppooled= &stack_pool; *ppooled!=NULL; ppooled= &(*ppooled)->next)
+    if ((*ppooled)->size==size)
+    {
+      PooledStack *pooled= *ppooled;
+      *ppooled= pooled->next;
+      pool_resident-= pooled->resident;
+      return (SP)pooled;
+    }
+
+  region= mmap(NULL, page_size+size, PROT_READ|PROT_WRITE,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (region==MAP_FAILED)
+    nFatalError("AllocStack", "Se acabo la memoria\n");
+  if (mprotect(region, page_size, PROT_NONE)!=0)
+    nFatalError("AllocStack", "No se pudo proteger la pagina de guardia\n");
+
+  return (SP)(region+page_size);
+}
+
+void FreeStack(SP stack, int size)
+{
+  PooledStack *pooled= (PooledStack *)stack;
+
+  if (stack==NULL) return; /* El nMain usa el stack del proceso Unix */
+
+  size= (size+page_size-1) & -page_size;
+
+  if (pool_resident+size>STACK_POOL_HIGHWATER && size>page_size)
+  { /* Solo queda residente la pagina con el descriptor */
+    madvise((char *)stack+page_size, size-page_size, MADV_DONTNEED);
+    pooled->resident= page_size;
+  }
+  else
+    pooled->resident= size;
+  pool_resident+= pooled->resident;
+
+  pooled->size= size;
+  pooled->next= stack_pool;
+  stack_pool= pooled;
+}
+
+static void StackSegvHandler(int sig, siginfo_t *info, void *context)
+{
+  char *addr= (char *)info->si_addr;
+  char *stack= (char *)current_task->stack;
+
+  if (stack!=NULL && stack-page_size<=addr && addr<stack)
+    nFatalError("SIGSEGV", "Desborde de pila (agrande el stack con "
+                "nSetStackSize)\n");
+
+  /* No es un desborde: se deja que el SIGSEGV siga su curso normal */
+  signal(SIGSEGV, SIG_DFL);
+}
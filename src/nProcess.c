@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 static nTask MakeTask(int stack_size);
 
@@ -13,20 +14,41 @@ static void VtimerHandler();
  * El prologo y el epilogo
  *************************************************************/
 
-Queue ready_queue;  /* Las tareas ready */
-nTask current_task; /* La tarea running */
+__thread Queue ready_queue;  /* Las tareas ready */
+__thread nTask current_task; /* La tarea running */
 
-int cpu_status = RUNNING; /* Estado del procesador */
+__thread int cpu_status = RUNNING; /* Estado del procesador */
 
 static nTask main_task; /* La tarea que corre nMain */
 
-static int context_changes = 0; /* nro de cambios de contexto implicitos */
+static SlabCache task_cache = SLAB_CACHE(struct Task, CACHE_LINE);
+
+/* Un worker por thread del nucleo (ver el modo M:N mas abajo).  Sin
+ * modo M:N solo existe worker_table[0].
+ */
+
+#define MAX_WORKERS 256
+
+typedef struct Worker
+{
+  int id;
+  Queue ready_queue;   /* La cola ready del worker */
+  nTask idle;          /* Corre cuando el worker no tiene tareas */
+  int context_changes; /* Ver nGetContextSwitches */
+  int steals;          /* Tareas que le robo a otros workers */
+} Worker;
+
+static Worker worker_table[MAX_WORKERS];
+static __thread Worker *this_worker;
+
 static double rq_sum_length = 0.0;
 static int rq_n = 0;
 
 void ProcessInit()
 {
-  ready_queue = MakeQueue();
+  this_worker = &worker_table[0];
+  ready_queue = this_worker->ready_queue = MakeQueue();
+  StackInit();
   main_task = current_task = MakeTask(0);
   /* el nMain usa el stack del proceso Unix */
   nSetTaskName("nMain");
@@ -34,17 +56,30 @@ void ProcessInit()
 
 void ProcessEnd()
 {
-  nFprintf(2, "\nNro. de cambios de contextos implicitos: %d\n",
-           context_changes);
+  int i;
+
+  if (workers == 1)
+    nFprintf(2, "\nNro. de cambios de contextos implicitos: %d\n",
+             worker_table[0].context_changes);
+  else
+    for (i = 0; i < workers; i++)
+      nFprintf(2, "%sWorker %d: %d cambios de contexto, %d tareas robadas\n",
+               i == 0 ? "\n" : "", i, worker_table[i].context_changes,
+               worker_table[i].steals);
   if (rq_n != 0)
     nFprintf(2, "Largo promedio de la cola ``ready'': %f\n",
              rq_sum_length / rq_n);
 
-  if (!EmptyQueue(ready_queue))
-    nFprintf(2, "\nTareas que quedaron ``ready'':\n");
+  for (i = 0; i < workers; i++)
+  {
+    Queue queue = worker_table[i].ready_queue;
+
+    if (!EmptyQueue(queue))
+      nFprintf(2, "\nTareas que quedaron ``ready'':\n");
 
-  while (!EmptyQueue(ready_queue))
-    DescribeTask(GetTask(ready_queue));
+    while (!EmptyQueue(queue))
+      DescribeTask(GetTask(queue));
+  }
 }
 
 nTask nCurrentTask()
@@ -52,9 +87,15 @@ nTask nCurrentTask()
   return current_task;
 }
 
+/* Estadisticas del scheduler, del worker que las consulta.  Con un
+ * solo worker se cuentan los cambios de contexto implicitos (por
+ * tajadas de tiempo).  En modo M:N no hay tajadas y se cuentan todos
+ * los cambios de contexto del worker.
+ */
+
 int nGetContextSwitches()
 {
-  return context_changes;
+  return this_worker->context_changes;
 }
 
 int nGetQueueLength()
@@ -70,7 +111,12 @@ int nGetQueueLength()
  * Definicion de parametros para las tareas
  *************************************************************/
 
-static int current_stack_size = 8192; /* Taman~o de un stack */
+/* Las senales que llegan dentro de una seccion critica se anotan en un
+ * handler que corre sobre el stack de la tarea, por lo que el marco de
+ * senal del nucleo (varios KB con AVX-512) puede aparecer en cualquier
+ * punto.  8 KB ya no alcanzan.
+ */
+static int current_stack_size = 32768; /* Taman~o de un stack */
 
 /*
  * Define el taman~o del stack de una tarea.
@@ -97,12 +143,34 @@ int current_slice = 0;
 void nSetTimeSlice(int slice)
 {
   START_CRITICAL();
-  current_slice = slice;
+  current_slice = workers > 1 ? 0 : slice; /* No hay tajadas en modo M:N */
   SetAlarm(VIRTUALTIMER, current_slice, VtimerHandler);
   /* Si current_slice==0, el timer deja de interrumpir */
   END_CRITICAL();
 }
 
+/*
+ * Politica para despertar a una tarea (ver WakeTask).  Por omision
+ * se le cede la CPU de inmediato.
+ */
+
+int wake_policy = WAKE_HANDOFF;
+
+int nSetWakePolicy(int policy)
+{
+  int prev;
+
+  if (policy!=WAKE_HANDOFF && policy!=WAKE_FRONT && policy!=WAKE_BACK)
+    nFatalError("nSetWakePolicy", "Politica desconocida: %d\n", policy);
+
+  START_CRITICAL();
+  prev = wake_policy;
+  wake_policy = policy;
+  END_CRITICAL();
+
+  return prev;
+}
+
 /*************************************************************
  * El scheduler
  *************************************************************/
@@ -123,11 +191,19 @@ void nSetTimeSlice(int slice)
 
 /* Retoma la proxima tarea ready, sin considerar la tarea actual */
 
+static void ResumeNextWorkerTask();
+
 void ResumeNextReadyTask()
 {
   nTask next_task;
   nTask this_task;
 
+  if (workers > 1)
+  {
+    ResumeNextWorkerTask(); /* Modo M:N */
+    return;
+  }
+
   while (EmptyQueue(ready_queue))
   {
     /* No hay tareas "ready".  Todas las tareas estan en alguna cola
@@ -184,6 +260,255 @@ void ResumeNextReadyTask()
    */
 }
 
+/* Cede la CPU directamente a next_task, sin pasar por la ready_queue.
+ * next_task debe estar READY y fuera de toda cola, y la tarea actual
+ * ya debe haber quedado en espera de algo, igual que al invocar
+ * ResumeNextReadyTask.  Lo usan nSend y nReplyAndReceive para
+ * entregarle la CPU a la contraparte del mensaje.
+ */
+
+void SwitchToTask(nTask next_task)
+{
+  nTask this_task = current_task;
+
+  /* Debugging: Se chequea la integridad de los stacks */
+  CheckStack(this_task->stack);
+  CheckStack(next_task->stack);
+
+  if (workers > 1)
+    this_worker->context_changes++;
+  ChangeContext(this_task, next_task);
+
+  current_task = this_task;
+}
+
+/* Despierta a task, que no esta en ninguna cola, segun policy:
+ *
+ * WAKE_HANDOFF => task toma la CPU de inmediato y la tarea actual
+ *                 queda primera en la cola ready.
+ * WAKE_FRONT   => task queda primera en la cola ready.
+ * WAKE_BACK    => task queda ultima en la cola ready.
+ *
+ * Con WAKE_FRONT y WAKE_BACK la tarea actual sigue corriendo, lo que
+ * evita un cambio de contexto por cada tarea despertada.
+ */
+
+void WakeTask(nTask task, int policy)
+{
+  task->status = READY;
+  if (policy==WAKE_BACK)
+    PutTask(ready_queue, task);
+  else if (policy==WAKE_FRONT)
+    PushTask(ready_queue, task);
+  else
+  {
+    PushTask(ready_queue, current_task); /* Sigue estando ready */
+    PushTask(ready_queue, task);
+    ResumeNextReadyTask(); /* task es la primera en la cola */
+  }
+}
+
+/*************************************************************
+ * Modo M:N
+ *************************************************************/
+
+/* Con nSetWorkers(n) las tareas corren en n threads del nucleo, los
+ * ``workers'': el thread del proceso Unix y n-1 threads nuevos.  Cada
+ * worker tiene su propia cola ready.  ResumeNextReadyTask retoma la
+ * primera tarea de la cola del worker y, si esta vacia, le roba a otro
+ * worker la mitad de su cola (a lo mas STEAL_MAX tareas).  Si no hay
+ * nada que robar, cede la CPU a la tarea ociosa del worker, que espera
+ * en WaitSignal con su propia pila: la tarea que se bloqueo puede ser
+ * retomada por otro worker mientras tanto.
+ *
+ * Las primitivas corren con big_lock tomado (ver nDep.c), asi que las
+ * colas ready se roban sin otra sincronizacion y colas tipo Chase-Lev
+ * no ganarian nada.  Lo que corre en paralelo es el codigo de las
+ * tareas entre una primitiva y otra.  Este modo no admite tajadas de
+ * tiempo: una tarea interrumpida por una senal no puede continuar en
+ * otro thread.  Por lo mismo, una tarea puede cambiar de thread en
+ * cualquier primitiva que la bloquee; no debe guardar la direccion de
+ * una variable __thread (como errno) de una primitiva a otra.
+ */
+
+#define STEAL_MAX 64
+
+static int idle_workers = 0; /* Workers esperando en WaitSignal */
+
+/* Roba tareas ready de otro worker y retorna la primera, o NULL */
+
+static nTask StealTask()
+{
+  int i, k, len;
+  nTask task;
+
+  for (i = 1; i < workers; i++)
+  {
+    Worker *victim = &worker_table[(this_worker->id + i) % workers];
+    Queue queue = victim->ready_queue;
+
+    len = 0;
+    for (task = queue->first; task != NULL && len < 2 * STEAL_MAX;
+         task = task->next_task)
+      len++;
+    if (len == 0)
+      continue;
+
+    /* La mitad: la primera se retoma de inmediato, las otras se encolan */
+    task = GetTask(queue);
+    for (k = 1; k < (len + 1) / 2; k++)
+      PutTask(ready_queue, GetTask(queue));
+    this_worker->steals += (len + 1) / 2;
+    return task;
+  }
+
+  return NULL;
+}
+
+/* ResumeNextReadyTask en modo M:N */
+
+static void ResumeNextWorkerTask()
+{
+  nTask this_task = current_task;
+  nTask next_task = GetTask(ready_queue);
+
+  if (next_task == NULL)
+    next_task = StealTask();
+  if (next_task == NULL)
+    next_task = this_worker->idle;
+
+  CheckStack(this_task->stack);
+  CheckStack(next_task->stack);
+
+  this_worker->context_changes++;
+  ChangeContext(this_task, next_task);
+
+  current_task = this_task;
+}
+
+/* La tarea ociosa de un worker: retoma tareas mientras haya y si no
+ * espera interrupciones, como el ciclo de espera de
+ * ResumeNextReadyTask.  Corre siempre con big_lock tomado, salvo
+ * mientras WaitIO espera en epoll.
+ */
+
+static void IdleLoop()
+{
+  Worker *self = this_worker; /* La tarea ociosa nunca cambia de thread */
+  nTask next_task;
+
+  nSetTaskName("worker %d", self->id);
+  for (;;)
+  {
+    next_task = GetTask(ready_queue);
+    if (next_task == NULL)
+      next_task = StealTask();
+
+    if (next_task != NULL)
+    {
+      CheckStack(next_task->stack);
+      self->context_changes++;
+      ChangeContext(self->idle, next_task);
+      current_task = self->idle;
+    }
+    else
+    {
+      cpu_status = WAIT_INTERRUPT;
+      idle_workers++;
+      WaitSignal();
+      idle_workers--;
+      cpu_status = RUNNING;
+    }
+  }
+}
+
+/* Invocado al salir de la seccion critica mas externa: si quedan
+ * tareas en la cola de este worker y hay workers ociosos, despierta a
+ * uno para que las robe.
+ */
+
+void KickWorkers()
+{
+  if (idle_workers > 0 && !EmptyQueue(ready_queue))
+    KickIO();
+}
+
+/* Los workers 1..n-1: su tarea ociosa usa la pila del thread */
+
+static sigset_t worker_mask; /* Mascara original de senales */
+
+static void *WorkerMain(void *arg)
+{
+  Worker *w = (Worker *)arg;
+
+  AltStackInit();
+  this_worker = w;
+  ready_queue = w->ready_queue;
+
+  START_CRITICAL(); /* Espera a que nSetWorkers suelte big_lock */
+  current_task = w->idle = MakeTask(0);
+  /* Recien ahora un handler encuentra current_task y ready_queue */
+  pthread_sigmask(SIG_SETMASK, &worker_mask, NULL);
+  IdleLoop();
+
+  return NULL; /* Nunca llega aca */
+}
+
+/* Pasa a modo M:N con n workers.  Se invoca una sola vez (ver la
+ * opcion -workers en nMain.c).  Desde ahi nSetTimeSlice no tiene efecto.
+ */
+
+void nSetWorkers(int n)
+{
+  nTask this_task;
+  pthread_t thread;
+  sigset_t all;
+  int i;
+
+  START_CRITICAL();
+
+  if (workers > 1)
+    nFatalError("nSetWorkers", "El modo M:N ya estaba activo\n");
+  if (n < 1 || n > MAX_WORKERS)
+    nFatalError("nSetWorkers", "Nro. de workers invalido: %d\n", n);
+
+  if (n > 1)
+  {
+    nSetTimeSlice(0);
+    KickInit();
+    LockWorkers(); /* Todavia no hay otros threads: no espera */
+    workers = n;
+
+    /* Los threads nacen con las senales bloqueadas: el timer puede
+     * llegarle a cualquiera y un handler necesita current_task.
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &worker_mask);
+    for (i = 1; i < n; i++)
+    {
+      worker_table[i].id = i;
+      worker_table[i].ready_queue = MakeQueue();
+      if (pthread_create(&thread, NULL, WorkerMain, &worker_table[i]) != 0)
+        nFatalError("nSetWorkers", "No se pudo crear el worker %d\n", i);
+      pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &worker_mask, NULL);
+
+    /* La tarea ociosa del worker 0 necesita una pila propia: la del
+     * proceso Unix es la del nMain.  Parte como nEmitTask una tarea.
+     */
+    this_task = current_task;
+    this_worker->idle = MakeTask(current_stack_size);
+    MarkStack(this_worker->idle->stack);
+    PushTask(ready_queue, this_task);
+    current_task = this_worker->idle;
+    CallInNewContext(this_task, this_worker->idle, IdleLoop, NULL);
+    current_task = this_task;
+  }
+
+  END_CRITICAL();
+}
+
 /*
  * Entrada y Salida de Handlers ``preemptive'', es decir que la
  * interrupcion puede quitarle la CPU a la tarea actual.
@@ -218,7 +543,7 @@ void PreemptTask()
 
   if (cpu_status == RUNNING && current_slice != 0)
   {
-    context_changes++;
+    this_worker->context_changes++;
     PushTask(ready_queue, current_task);
   }
 }
@@ -256,12 +581,14 @@ static void VtimerHandler()
    */
   SetAlarm(VIRTUALTIMER, current_slice, VtimerHandler);
 
+  ReapIO(); /* Las tareas con E/S de archivos terminada quedan ready */
+
   rq_sum_length += QueueLength(ready_queue);
   rq_n++;
 
   if (cpu_status == RUNNING)
   {
-    context_changes++; /* solo para saber cuantos cambios implicitos hubo */
+    this_worker->context_changes++; /* solo para las estadisticas */
 
     PutTask(ready_queue, current_task); /* Al final de la ``ready_queue'' */
     ResumeNextReadyTask();              /* Este procedimiento retorna cuando a esta */
@@ -321,6 +648,8 @@ nTask nEmitTask(int (*proc)(), ...)
   /***** EL CAMBIO DE CONTEXTO ********/
 
   current_task = newTask; /* No sabemos hacerlo en ``TaskInit'' */
+  if (workers > 1)
+    this_worker->context_changes++;
 
   CallInNewContext(this_task, newTask, TaskInit, (void *)&info);
 
@@ -365,18 +694,26 @@ static void TaskInit(InfoEmit *pinfo)
 
 static nTask MakeTask(int stack_size)
 {
-  nTask newTask = (nTask)nMalloc(sizeof(*newTask));
+  nTask newTask = (nTask)SlabAlloc(&task_cache);
   newTask->status = READY;
   newTask->taskname = NULL;
   newTask->waitTask = NULL; /* Ninguna tarea ha hecho nAbsorb */
   newTask->send_queue = MakeQueue();
-  newTask->requestQueue = MakeFifoQueue();
-  newTask->stack = stack_size == 0 ? NULL : (SP)nMalloc(stack_size);
+  newTask->stack = stack_size == 0 ? NULL : AllocStack(stack_size);
+  newTask->stack_size = stack_size;
   newTask->sp = &newTask->stack[stack_size / sizeof(void *)];
   /* AMD64 requiere que la pila este alineada a 16 bytes */
   newTask->sp = (SP)((long)newTask->sp & ~0xfL);
   newTask->queue = NULL;
-  newTask->pendingRequests = 0;
+  newTask->timer.next = NULL;
+  newTask->timer.pprev = NULL;
+  newTask->timed_out = FALSE;
+  newTask->wait_addr = NULL;
+  newTask->share = NULL;
+  newTask->holds = NULL;
+  newTask->lease = 0;
+  newTask->arrivals = 0;
+  newTask->mailbox = NULL;
 
   return newTask;
 }
@@ -425,12 +762,19 @@ void nExitTask(int rc)
   current_task->rc = rc; /* el codigo de retorno */
 
   /* La tarea que estaba en espera de este nExitTask se coloca en la
-     * cola de tareas ready.
+     * cola de tareas ready.  Si su nWaitTaskTimeout ya vencio, ya esta
+     * READY.
      */
   if (current_task->waitTask != NULL)
   {
-    current_task->waitTask->status = READY;
-    PushTask(ready_queue, current_task->waitTask);
+    nTask wait_task = current_task->waitTask;
+    if (wait_task->status == WAIT_TASK_TIMEOUT)
+      CancelTask(wait_task);
+    if (wait_task->status == WAIT_TASK || wait_task->status == WAIT_TASK_TIMEOUT)
+    {
+      wait_task->status = READY;
+      PushTask(ready_queue, wait_task);
+    }
   }
 
   current_task->status = ZOMBIE; /* Consultado por nWaitTask */
@@ -470,11 +814,49 @@ int nWaitTask(nTask task)
                 "Hay %d tarea(s) en la cola de la tarea moribunda\n",
                 QueueLength(task->send_queue));
   DestroyQueue(task->send_queue);
-  nFree(task->stack); /* Libera los recursos de la tarea */
+  DestroyMailbox(task);
+  DestroyShare(task);
+  FreeStack(task->stack, task->stack_size); /* Libera los recursos de la tarea */
   rc = task->rc;
-  nFree(task);
+  SlabFree(&task_cache, task);
 
   END_CRITICAL();
 
   return rc;
 }
+
+/* Como nWaitTask, pero espera a lo mas timeout milisegundos (<0 es
+ * indefinidamente, 0 no espera).  Retorna verdadero y el codigo de
+ * retorno de task en *prc, o falso si vencio el timeout.  En ese caso
+ * la tarea se puede volver a esperar.
+ */
+
+int nWaitTaskTimeout(nTask task, int timeout, int *prc)
+{
+  int ok = TRUE;
+
+  START_CRITICAL();
+
+  if (task->waitTask != NULL)
+    nFatalError("nWaitTaskTimeout",
+                "Dos tareas no pueden esperar la misma tarea\n");
+
+  if (timeout > 0 && task->status != ZOMBIE)
+  {
+    task->waitTask = current_task;
+    current_task->status = WAIT_TASK_TIMEOUT;
+    ProgramQueueTask(timeout);
+    ResumeNextReadyTask();
+    task->waitTask = NULL;
+    ok = !current_task->timed_out;
+  }
+  else if (timeout == 0 && task->status != ZOMBIE)
+    ok = FALSE;
+
+  if (ok)
+    *prc = nWaitTask(task);
+
+  END_CRITICAL();
+
+  return ok;
+}
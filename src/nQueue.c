@@ -7,9 +7,11 @@
  * Colas para Scheduling de CPU : Queue
  *************************************************************/
 
+static SlabCache queue_cache= SLAB_CACHE(struct Queue, sizeof(void *));
+
 Queue MakeQueue() /* Puede ser llamada de cualquier parte */
 {
-  Queue queue= (Queue) nMalloc(sizeof(*queue));
+  Queue queue= (Queue) SlabAlloc(&queue_cache);
   queue->type= TYPE_QUEUE;
   queue->first= NULL;
   queue->last= &queue->first;
@@ -85,6 +87,21 @@ void DeleteTaskQueue(Queue queue, nTask task)
   task->queue= NULL;
 }
 
+/* Traspasa todas las tareas de src al final de queue en O(1), dejando
+ * src vacia.  Quien llama debe asignar queue al campo queue de cada
+ * tarea traspasada (lo hace en la misma pasada en que las prepara).
+ */
+
+void AppendQueue(Queue queue, Queue src)
+{
+  if (src->first==NULL) return;
+
+  *(queue->last)= src->first;
+  queue->last= src->last;
+  src->first= NULL;
+  src->last= &src->first;
+}
+
 int EmptyQueue(Queue queue)
 {
   return queue->first==NULL;
@@ -109,88 +126,223 @@ void DestroyQueue(Queue queue) /* Puede ser llamada de cualquier parte */
   if (!EmptyQueue(queue))
     nFatalError("DelQueue","Se destruye una cola con tareas pendientes\n");
 
-  nFree(queue);  /* Se supone que no hay procesos colgando */
+  SlabFree(&queue_cache, queue);  /* Se supone que no hay procesos colgando */
 }
 
 /*************************************************************
- * Colas ordenadas por tiempo : Squeue
+ * Rueda de tiempo jerarquica : TimeWheel
  *************************************************************/
 
-Squeue MakeSqueue()
-{
-  Squeue squeue= (Squeue) nMalloc(sizeof(*squeue));
-  squeue->type= TYPE_SQUEUE;
-  squeue->first= NULL;
+/* Cada ranura es una lista doblemente encadenada (next y pprev), asi
+ * que sacar un timer no requiere buscarlo.  El bit de una ranura en
+ * used puede quedar encendido aunque la ranura se vacie al cancelar un
+ * timer: solo significa que GetNextTimeWheel puede entregar un tiempo
+ * anterior al real (un despertar de mas, inofensivo).
+ */
 
-  return squeue;
-}
+#define LEVEL_SPAN(level) (1<<(WHEEL_BITS*((level)+1)))
+#define SLOT(time, level) (((time)>>(WHEEL_BITS*(level))) & WHEEL_MASK)
 
-void PutTaskSqueue(Squeue squeue, nTask task, int wake_time)
+TimeWheel MakeTimeWheel(int now)
 {
-  nTask *ptask;
+  TimeWheel wheel= (TimeWheel) nMalloc(sizeof(*wheel));
+  int level, slot;
 
-  /* VerifyCritical("ProgramTask"); */
-  if (task->queue!=NULL)
-    nFatalError("ProgramTask", "La tarea ya estaba en alguna cola\n");
-  task->queue= squeue;
-
-  ptask= &squeue->first;
-  while (*ptask!=NULL && (*ptask)->wake_time-wake_time<0)
-    ptask= &(*ptask)->next_task;
+  wheel->type= TYPE_WHEEL;
+  wheel->base= now;
+  wheel->count= 0;
+  for (level= 0; level<WHEEL_LEVELS; level++)
+  {
+    wheel->used[level]= 0;
+    for (slot= 0; slot<WHEEL_SIZE; slot++)
+      wheel->slots[level][slot]= NULL;
+  }
 
-  task->wake_time= wake_time;
-  task->next_task= *ptask;
-  *ptask= task;
+  return wheel;
 }
 
-nTask GetTaskSqueue(Squeue squeue)
+/* Coloca el timer en la ranura que le corresponde segun wheel->base */
+
+static void LinkTimer(TimeWheel wheel, Timer *timer)
 {
-  nTask task;
+  int expires= timer->wake_time;
+  int delta= expires-wheel->base;
+  int level;
+  Timer **pslot;
 
-  /* VerifyCritical("GetNextProgrammedTask"); */
+  if (delta<0)
+  {
+    expires= wheel->base; /* Ya vencio: se procesa en el proximo avance */
+    delta= 0;
+  }
 
-  task= squeue->first;
-  if (task==NULL) return NULL;
+  for (level= 0; level<WHEEL_LEVELS-1 && delta>=LEVEL_SPAN(level); level++)
+    ;
+  if (delta>=LEVEL_SPAN(level))
+    expires= wheel->base+LEVEL_SPAN(level)-1; /* Mas alla del ultimo nivel */
 
-  squeue->first= task->next_task;
+  pslot= &wheel->slots[level][SLOT(expires, level)];
+  wheel->used[level] |= 1ULL<<SLOT(expires, level);
 
-  task->queue= NULL;
+  timer->next= *pslot;
+  if (timer->next!=NULL) timer->next->pprev= &timer->next;
+  timer->pprev= pslot;
+  *pslot= timer;
+}
 
-  return task;
+void PutTimerWheel(TimeWheel wheel, Timer *timer, int wake_time)
+{
+  /* VerifyCritical("PutTimerWheel"); */
+  if (timer->pprev!=NULL)
+    nFatalError("PutTimerWheel", "El timer ya estaba programado\n");
+
+  timer->wake_time= wake_time;
+  LinkTimer(wheel, timer);
+  wheel->count++;
 }
 
-int GetNextTimeSqueue(Squeue squeue)
+void DeleteTimerWheel(TimeWheel wheel, Timer *timer)
 {
-  return squeue->first==NULL ? 0 : squeue->first->wake_time ;
+  /* VerifyCritical("DeleteTimerWheel"); */
+  if (timer->pprev==NULL)
+    nFatalError("DeleteTimerWheel", "El timer no estaba programado\n");
+
+  *timer->pprev= timer->next;
+  if (timer->next!=NULL) timer->next->pprev= timer->pprev;
+  timer->next= NULL;
+  timer->pprev= NULL;
+  wheel->count--;
 }
 
-int EmptySqueue(Squeue squeue)
+/* Saca todos los timers de una ranura y los vuelve a colocar respecto
+ * de la nueva base (bajan a un nivel inferior).
+ */
+
+static void Cascade(TimeWheel wheel, int level, int slot)
 {
-  return squeue->first==NULL;
+  Timer *timer= wheel->slots[level][slot];
+
+  wheel->slots[level][slot]= NULL;
+  wheel->used[level] &= ~(1ULL<<slot);
+
+  while (timer!=NULL)
+  {
+    Timer *next= timer->next;
+    LinkTimer(wheel, timer);
+    timer= next;
+  }
 }
 
-void DeleteTaskSqueue(Squeue squeue, nTask task)
+int ExpireTimersWheel(TimeWheel wheel, int curr_time)
 {
-  nTask *ptask;
+  int expired= 0;
 
-  /* VerifyCritical("DeleteTaskSqueue"); */
+  /* VerifyCritical("ExpireTimersWheel"); */
 
-  ptask= &squeue->first;
-  while (*ptask!=task && *ptask!=NULL &&
-         (*ptask)->wake_time-task->wake_time<=0)
-    ptask= &(*ptask)->next_task;
+  while (curr_time-wheel->base>=0)
+  {
+    int slot= wheel->base & WHEEL_MASK;
+    unsigned long long ahead;
+
+    if (slot==0)
+    { /* Se completo una vuelta del nivel 0: bajan los del nivel 1, etc. */
+      int level;
+      for (level= 1; level<WHEEL_LEVELS; level++)
+      {
+        int upper= SLOT(wheel->base, level);
+        Cascade(wheel, level, upper);
+        if (upper!=0) break;
+      }
+    }
+
+    while (wheel->slots[0][slot]!=NULL)
+    {
+      Timer *timer= wheel->slots[0][slot];
+      DeleteTimerWheel(wheel, timer);
+      (*timer->expire)(timer);
+      expired++;
+    }
+    wheel->used[0] &= ~(1ULL<<slot);
+
+    /* Se salta directo a la proxima ranura ocupada del nivel 0
+     * (o al fin de la vuelta), sin pasar por las ranuras vacias.
+     */
+    ahead= slot==WHEEL_MASK ? 0 : wheel->used[0] & (~0ULL<<(slot+1));
+    if (ahead!=0)
+    {
+      int next= __builtin_ctzll(ahead);
+      if (curr_time-(wheel->base+next-slot)<0)
+      {
+        wheel->base= curr_time+1;
+        break;
+      }
+      wheel->base+= next-slot;
+    }
+    else if (curr_time-(wheel->base+WHEEL_SIZE-slot)<0)
+    {
+      wheel->base= curr_time+1;
+      break;
+    }
+    else
+      wheel->base+= WHEEL_SIZE-slot;
+  }
+
+  return expired;
+}
 
-  if (*ptask!=task)
-    nFatalError("DeleteTaskSqueue",
-                "No se encontro la tarea especificada\n");
+int GetNextTimeWheel(TimeWheel wheel)
+{
+  int slot= wheel->base & WHEEL_MASK;
+  unsigned long long ahead= wheel->used[0] & (~0ULL<<slot);
+  int level, next= 0, found= FALSE;
+
+  if (slot==0)
+    return wheel->base; /* Falta la cascada de esta vuelta */
+
+  if (ahead!=0)
+    return wheel->base+__builtin_ctzll(ahead)-slot;
+
+  /* Nada mas en esta vuelta del nivel 0.  No hace falta despertar al
+   * comienzo de cada vuelta: los timers guardan su wake_time exacto y
+   * ExpireTimersWheel hace todas las cascadas pendientes al llegar a
+   * ese tiempo.  Se entrega el menor entre la primera ranura ocupada
+   * del nivel 0 en la proxima vuelta y, en cada nivel superior, los
+   * timers de la primera ranura no vacia despues de la actual (la
+   * actual solo puede tener timers de la proxima vuelta de ese nivel).
+   */
+  if (wheel->used[0]!=0)
+  {
+    next= wheel->base+WHEEL_SIZE-slot+__builtin_ctzll(wheel->used[0]);
+    found= TRUE;
+  }
+  for (level= 1; level<WHEEL_LEVELS; level++)
+  {
+    int curr= SLOT(wheel->base, level), i;
+    for (i= 1; i<=WHEEL_SIZE && wheel->used[level]!=0; i++)
+    {
+      Timer *timer= wheel->slots[level][(curr+i) & WHEEL_MASK];
+      if (timer==NULL) continue;
+      for (; timer!=NULL; timer= timer->next)
+        if (!found || timer->wake_time-next<0)
+        {
+          next= timer->wake_time;
+          found= TRUE;
+        }
+      break;
+    }
+  }
 
-  *ptask= task->next_task;
-  task->queue= NULL;
+  return found ? next : wheel->base+WHEEL_SIZE-slot;
+}
+
+int EmptyWheel(TimeWheel wheel)
+{
+  return wheel->count==0;
 }
 
-void DestroySqueue(Squeue squeue)
+void DestroyTimeWheel(TimeWheel wheel)
 {
-  if (!EmptySqueue(squeue))
-    nFatalError("DelSqueue", "Se destruye una cola con tareas pendientes\n");
-  nFree(squeue);  /* No hay procesos colgando */
+  if (!EmptyWheel(wheel))
+    nFatalError("DestroyTimeWheel", "Se destruye una rueda con timers pendientes\n");
+  nFree(wheel);  /* No hay procesos colgando */
 }
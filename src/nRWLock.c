@@ -0,0 +1,144 @@
+#include "nSysimp.h"
+
+/*************************************************************
+ * Candados de lectores/escritores
+ *************************************************************/
+
+/* Varios lectores pueden tener el candado a la vez, un escritor lo
+ * tiene solo.  Las tareas que esperan quedan en una sola cola FIFO
+ * (intrusiva, como la de los semaforos) con estado WAIT_RLOCK o
+ * WAIT_WLOCK.  Al liberar el candado se le entrega a las tareas que
+ * lo obtienen sin que puedan adelantarse otras: el escritor del
+ * principio de la cola o todos los lectores consecutivos del
+ * principio.  Quien libera sigue con la CPU.
+ *
+ * Con preferencia a los escritores un lector nuevo espera si hay algun
+ * escritor esperando; si no, solo si un escritor tiene el candado.  En
+ * ambos casos un lector que no tiene que esperar no cambia de contexto.
+ */
+
+typedef struct nRWLock
+{
+  int readers;         /* Nro. de lectores con el candado */
+  nTask writer;        /* El escritor con el candado o NULL */
+  int writers_waiting; /* Nro. de escritores en la cola */
+  int writer_pref;     /* Verdadero: preferencia a los escritores */
+  struct Queue *queue;
+}
+  *nRWLock;
+
+#define NOVOID_NRWLOCK
+
+#include "nSystem.h"
+
+static void Grant(nRWLock lock);
+
+nRWLock nMakeRWLock(int writer_pref)
+{
+  nRWLock lock= (nRWLock)nMalloc(sizeof(*lock));
+  lock->readers= 0;
+  lock->writer= NULL;
+  lock->writers_waiting= 0;
+  lock->writer_pref= writer_pref;
+  lock->queue= MakeQueue();
+  return lock;
+}
+
+void nDestroyRWLock(nRWLock lock)
+{
+  if (lock->readers>0 || lock->writer!=NULL || !EmptyQueue(lock->queue))
+    nFatalError("nDestroyRWLock",
+      "Se intenta destruir un candado ocupado\n");
+  DestroyQueue(lock->queue);
+  nFree(lock);
+}
+
+void nReadLock(nRWLock lock)
+{
+  START_CRITICAL();
+
+  if (lock->writer==current_task)
+    nFatalError("nReadLock", "This task already owns the lock for writing\n");
+
+  if (lock->writer==NULL && (!lock->writer_pref || lock->writers_waiting==0))
+    lock->readers++;
+  else
+  {
+    current_task->status= WAIT_RLOCK;
+    PutTask(lock->queue, current_task);
+    ResumeNextReadyTask(); /* Vuelve con el candado (ver Grant) */
+  }
+
+  END_CRITICAL();
+}
+
+void nReadUnlock(nRWLock lock)
+{
+  START_CRITICAL();
+
+  if (lock->readers==0)
+    nFatalError("nReadUnlock", "The lock is not held for reading\n");
+  if (--lock->readers==0)
+    Grant(lock);
+
+  END_CRITICAL();
+}
+
+void nWriteLock(nRWLock lock)
+{
+  START_CRITICAL();
+
+  if (lock->writer==current_task)
+    nFatalError("nWriteLock", "Trying to own the same lock twice\n");
+
+  if (lock->writer==NULL && lock->readers==0 && EmptyQueue(lock->queue))
+    lock->writer= current_task;
+  else
+  {
+    lock->writers_waiting++;
+    current_task->status= WAIT_WLOCK;
+    PutTask(lock->queue, current_task);
+    ResumeNextReadyTask(); /* Vuelve con el candado (ver Grant) */
+  }
+
+  END_CRITICAL();
+}
+
+void nWriteUnlock(nRWLock lock)
+{
+  START_CRITICAL();
+
+  if (lock->writer!=current_task)
+    nFatalError("nWriteUnlock", "This task does not own this lock\n");
+  lock->writer= NULL;
+  Grant(lock);
+
+  END_CRITICAL();
+}
+
+/* Entrega el candado libre al escritor del principio de la cola o a
+ * los lectores consecutivos del principio, y los pasa a la cola ready.
+ */
+
+static void Grant(nRWLock lock)
+{
+  nTask task= lock->queue->first;
+
+  if (task!=NULL && task->status==WAIT_WLOCK)
+  {
+    GetTask(lock->queue);
+    lock->writers_waiting--;
+    lock->writer= task;
+    task->status= READY;
+    PutTask(ready_queue, task);
+    return;
+  }
+
+  while ((task= lock->queue->first)!=NULL && task->status==WAIT_RLOCK)
+  {
+    GetTask(lock->queue);
+    lock->readers++;
+    task->status= READY;
+    PutTask(ready_queue, task);
+  }
+}
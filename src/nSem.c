@@ -8,6 +8,7 @@ typedef struct nSem
 {
   int count;
   struct Queue *queue;
+  int policy; /* WAKE_DEFAULT: la de nSetWakePolicy */
 }
   *nSem;
 
@@ -22,6 +23,7 @@ nSem nMakeSem(int count)
   sem= (nSem) nMalloc(sizeof(*sem));
   sem->count= count;
   sem->queue= MakeQueue();
+  sem->policy= WAKE_DEFAULT;
 
   return sem;
 }
@@ -42,6 +44,45 @@ void nWaitSem(nSem sem)
   END_CRITICAL();
 }
 
+/* Como nWaitSem, pero espera a lo mas timeout milisegundos (<0 es
+ * indefinidamente, 0 no espera).  Retorna verdadero si obtuvo una
+ * ficha del semaforo y falso si vencio el timeout.
+ */
+
+int nWaitSemTimeout(nSem sem, int timeout)
+{
+  int ok= TRUE;
+
+  START_CRITICAL();
+
+  if (sem->count>0)
+    sem->count--;
+  else if (timeout==0)
+    ok= FALSE;
+  else
+  {
+    if (timeout>0)
+    {
+      current_task->status= WAIT_SEM_TIMEOUT;
+      ProgramQueueTask(timeout);
+    }
+    else
+      current_task->status= WAIT_SEM;
+    PutTask(sem->queue, current_task);
+    ResumeNextReadyTask();
+    ok= timeout<0 || !current_task->timed_out;
+  }
+
+  END_CRITICAL();
+
+  return ok;
+}
+
+int nTryWaitSem(nSem sem)
+{
+  return nWaitSemTimeout(sem, 0);
+}
+
 void nSignalSem(nSem sem)
 {
   START_CRITICAL();
@@ -51,22 +92,39 @@ void nSignalSem(nSem sem)
     else
     {
        nTask wait_task= GetTask(sem->queue);
-       wait_task->status= READY;
-       /* wait_task ahora pasa al estado ready y queremos que
-        * tome la CPU.  La siguiente secuencia es la unica forma
-        * de transferir la CPU directamente a otra tarea.
-        */
-       PushTask(ready_queue, current_task); /* Sigue estando ready */
-       PushTask(ready_queue, wait_task);
-       ResumeNextReadyTask(); /* wait_task es la primera en la cola! */
-       /* Frecuentemente, esta tarea retomara la CPU cuando wait_task
-        * pierda la CPU.
+       if (wait_task->status==WAIT_SEM_TIMEOUT)
+         CancelTask(wait_task);
+       /* Con WAKE_HANDOFF wait_task toma la CPU de inmediato y
+        * frecuentemente esta tarea la retomara cuando wait_task
+        * la pierda.
         */
+       WakeTask(wait_task,
+                sem->policy==WAKE_DEFAULT ? wake_policy : sem->policy);
     }
 
   END_CRITICAL();
 }
 
+/* Fija la politica con que nSignalSem despierta a las tareas de este
+ * semaforo y retorna la anterior.  WAKE_DEFAULT vuelve a la global.
+ */
+
+int nSetSemWakePolicy(nSem sem, int policy)
+{
+  int prev;
+
+  if (policy!=WAKE_DEFAULT && policy!=WAKE_HANDOFF &&
+      policy!=WAKE_FRONT && policy!=WAKE_BACK)
+    nFatalError("nSetSemWakePolicy", "Politica desconocida: %d\n", policy);
+
+  START_CRITICAL();
+  prev= sem->policy;
+  sem->policy= policy;
+  END_CRITICAL();
+
+  return prev;
+}
+
 void nDestroySem(nSem sem)
 {
   if (! EmptyQueue(sem->queue) )
@@ -1,162 +1,1024 @@
 /**
  * Implementation of a concurrent sharing system using low level synchronization tools.
- * 
+ *
  * @author Ignacio Slater Muñoz
  * @version 1.0b15
  * @since 1.0
  */
-#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
 #include "nSysimp.h"
 #include <nSystem.h>
+#include "nLog.h"
 
 #pragma GCC diagnostic ignored "-Wunknown-pragmas"
 
-#pragma region : CONSTANTS
-static const char
-    *DEBUG = "DEBUG   ",
-    *ERROR = "ERROR   ";
+#pragma region : TYPES
+/**
+ * A value published by a sharing task.
+ * Every requester that receives the value pins it until its nRelease. A version
+ * lives until a newer one replaces it and its last pin is released. Until then it
+ * is also the cached last-shared value that nRequestFresh may return.
+ */
+typedef struct Version
+{
+  char *data;
+  int pins;                   // requesters that have not released this version
+  void (*retire)(char *data); // called once the version is no longer used
+} Version;
+
+/**
+ * The last values shared by a task, for nReadStream. Sequence numbers count the
+ * values shared since the stream was created; the value with number seq is in
+ * slots[seq % size] while first <= seq < next.
+ */
+typedef struct Stream
+{
+  int size;
+  unsigned first;     // the oldest value still in the ring
+  unsigned next;      // the number the next value will get
+  char **slots;
+  FifoQueue readers;  // tasks waiting in nReadStream for the next value
+} Stream;
+
+/**
+ * The sharing state of a task, created the first time somebody shares or
+ * requests through it, or of a name in the registry.
+ */
+typedef struct Share
+{
+  nTask owner;            // the task that shares, NULL for a named share
+  Version *current;       // what a request gets right now, NULL if nothing
+  Version *last;          // the last version shared, kept for nRequestFresh
+  int last_time;          // when last was shared
+  int waiting;            // TRUE while the owner is blocked inside nShare
+  int lazy;               // TRUE while the owner waits for a request in nShareLazy
+  int pinned;             // holds on this share, including expired leases
+  Queue waiters;          // requesters waiting for the next share
+  FifoQueue requestQueue; // same, for nRequestAny (it waits in several shares)
+  Stream *stream;         // NULL until somebody reads or sizes the stream
+} Share;
+
+/**
+ * A version held by a requester. Holds are linked from the requester task so
+ * nRelease knows which version to unpin. When a lease expires the version is
+ * unpinned and the hold stays, with a NULL version, until the late nRelease.
+ */
+typedef struct Hold
+{
+  struct Hold *next;
+  Share *share;
+  Version *version; // NULL once the lease expired
+  int leased;       // TRUE while the lease timer is programmed
+  Timer lease;      // force-releases the version if nRelease comes too late
+} Hold;
+
+/**
+ * An entry of the registry of named shares.
+ */
+typedef struct Named
+{
+  struct Named *next; // next entry in the same bucket
+  unsigned hash;
+  char *key;
+  Share share;
+} Named;
 #pragma endregion
 
 #pragma region : LOCAL VARIABLES
+static int expiredLeases = 0; // Leases that expired before their nRelease
+
+static SlabCache
+    share_cache = SLAB_CACHE(Share, sizeof(void *)),
+    version_cache = SLAB_CACHE(Version, sizeof(void *)),
+    hold_cache = SLAB_CACHE(Hold, sizeof(void *)),
+    stream_cache = SLAB_CACHE(Stream, sizeof(void *)),
+    named_cache = SLAB_CACHE(Named, sizeof(void *));
+
+static int streamSize = 64; // default size of a stream ring
+
+static Named **namedTable = NULL; // buckets of the registry, a power of 2
 static int
-    nShareCounter = 0,   // Id for the current share task
-    nReleaseCounter = 0, // Id for the current release task
-    nRequestCounter = 0; // Id for the current request task
+    namedSize = 0,  // number of buckets
+    namedCount = 0; // number of entries
 #pragma endregion
 
+#pragma region : LOCAL FUNCTIONS
+static void InitShare(Share *share, nTask owner)
+{
+  share->owner = owner;
+  share->current = NULL;
+  share->last = NULL;
+  share->last_time = 0;
+  share->waiting = FALSE;
+  share->lazy = FALSE;
+  share->pinned = 0;
+  share->waiters = MakeQueue();
+  share->requestQueue = MakeFifoQueue();
+  share->stream = NULL;
+}
+
 /**
- * Requests data from a task.
- * If there is an active share task, then the request returns its answer, otherwise it
- * waits until a task shares information or for a certain amount of time elapses.
- * 
- * @param t
- *    the task that will share information.
- * @param timeout
- *    the time the request waits for a respo nse.
-*/
-char *nRequest(nTask t, int timeout)
+ * Returns the sharing state of a task, creating it if needed.
+ */
+static Share *GetShare(nTask t)
 {
-  const char *context = "[nRequest]   ";
-  START_CRITICAL();
+  if (t->share == NULL)
+  {
+    t->share = (Share *)SlabAlloc(&share_cache);
+    InitShare(t->share, t);
+  }
+  return t->share;
+}
+
+static Version *MakeVersion(char *data, void (*retire)(char *data))
+{
+  Version *version = (Version *)SlabAlloc(&version_cache);
+  version->data = data;
+  version->pins = 0;
+  version->retire = retire;
+  return version;
+}
+
+/**
+ * Frees a version nobody uses anymore, letting its publisher reclaim the data.
+ */
+static void RetireVersion(Version *version)
+{
+  if (version->retire != NULL)
+    (*version->retire)(version->data);
+  SlabFree(&version_cache, version);
+}
+
+static Stream *GetStream(Share *share)
+{
+  if (share->stream == NULL)
+  {
+    Stream *stream = (Stream *)SlabAlloc(&stream_cache);
+    stream->size = streamSize;
+    stream->first = 0;
+    stream->next = 0;
+    stream->slots = (char **)nMalloc(streamSize * sizeof(char *));
+    stream->readers = MakeFifoQueue();
+    share->stream = stream;
+  }
+  return share->stream;
+}
+
+/**
+ * Adds a value to the stream ring, overwriting the oldest one if it is full, and
+ * wakes the tasks waiting in nReadStream. A reader whose timeout already expired
+ * is ready but still in the FifoQueue; it is skipped.
+ */
+static void AppendStream(Stream *stream, char *data)
+{
+  if (stream->next - stream->first == (unsigned)stream->size)
+    stream->first++;
+  stream->slots[stream->next % stream->size] = data;
+  stream->next++;
+
+  while (!EmptyFifoQueue(stream->readers))
+  {
+    nTask reader = GetObj(stream->readers);
+    if (reader->status != WAIT_STREAM && reader->status != WAIT_STREAM_TIMEOUT)
+      continue;
+    if (reader->status == WAIT_STREAM_TIMEOUT)
+      CancelTask(reader);
+    reader->status = READY;
+    PutTask(ready_queue, reader); // the publisher keeps the CPU
+  }
+}
+
+/**
+ * Makes version the one that requests get. The version it replaces is retired
+ * right away if nobody holds it, otherwise by its last nRelease.
+ */
+static void Publish(Share *share, Version *version)
+{
+  Version *old = share->last;
+  share->current = version;
+  share->last = version;
+  share->last_time = nGetTime();
+  if (version != NULL && share->stream != NULL)
+    AppendStream(share->stream, version->data);
+  if (old != NULL && old != version && old->pins == 0)
+    RetireVersion(old);
+}
+
+static void LeaseExpired(Timer *timer);
+
+/**
+ * Records that task holds version until it calls nRelease, or until the lease
+ * the task is requesting with expires.
+ */
+static void Pin(nTask task, Share *share, Version *version)
+{
+  Hold *hold = (Hold *)SlabAlloc(&hold_cache);
+  hold->share = share;
+  hold->version = version;
+  hold->leased = task->lease > 0;
+  hold->lease.next = NULL; /* SlabAlloc does not clear, as in MakeTask */
+  hold->lease.pprev = NULL;
+  if (hold->leased)
+    ProgramTimer(&hold->lease, task->lease, LeaseExpired);
+  hold->next = task->holds;
+  task->holds = hold;
+  version->pins++;
+  share->pinned++;
+}
+
+/**
+ * Undoes a Pin, except that the hold still counts in share->pinned. The version
+ * is retired if a newer one replaced it and this was its last pin.
+ *
+ * @return the owner of the share if it is in nShare waiting for this release,
+ *    NULL otherwise. The caller must make it ready.
+ */
+static nTask Unpin(Share *share, Version *version)
+{
+  if (--version->pins > 0)
+    return NULL;
+  if (version != share->last)
+  {
+    RetireVersion(version);
+    return NULL;
+  }
+  if (version == share->current && share->waiting)
+    return share->owner;
+  return NULL;
+}
+
+/**
+ * Force-releases a hold whose lease expired. Runs from the timer handler.
+ */
+static void LeaseExpired(Timer *timer)
+{
+  Hold *hold = (Hold *)((char *)timer - offsetof(Hold, lease));
+  nTask owner;
+
+  LOG(LEASE_EXPIRED, hold->share, hold->version->data, 0);
+  owner = Unpin(hold->share, hold->version);
+  hold->version = NULL;
+  hold->leased = FALSE;
+  expiredLeases++;
+  if (owner != NULL)
+  {
+    owner->status = READY;
+    PushTask(ready_queue, owner);
+  }
+}
 
-  nSetTaskName("REQUEST %d", nRequestCounter++);
-  (t->pendingRequests)++;
+/**
+ * Frees a hold that was unlinked from its task, unpinning its version unless the
+ * lease already did.
+ *
+ * @return the owner to wake, as in Unpin.
+ */
+static nTask FreeHold(Hold *hold)
+{
+  nTask owner = NULL;
 
-  if (t->status == WAIT_REPLY)
+  if (hold->leased)
+    CancelTimer(&hold->lease);
+  if (hold->version != NULL)
+    owner = Unpin(hold->share, hold->version);
+  hold->share->pinned--;
+  SlabFree(&hold_cache, hold);
+  return owner;
+}
+
+/**
+ * Hands version to every task waiting for this share. The waiters list only holds
+ * tasks still waiting, because RequestTimeout unlinks a task when its timeout
+ * expires. The FifoQueue of nRequestAny may still hold a task that was already
+ * answered by another share or timed out; it is skipped.
+ */
+static void AnswerRequests(Share *share, Version *version)
+{
+  nTask task;
+
+  // One pass pins the waiters, then the whole list goes to the ready queue. A
+  // timed out waiter already left the list in RequestTimeout.
+  for (task = share->waiters->first; task != NULL; task = task->next_task)
   {
-    nCurrentTask()->send.msg = t->send.msg;
-    nPrintf("%s%s%s was active, %s returned %X\n", DEBUG, context, t->taskname,
-            nGetTaskName(), nCurrentTask()->send.msg);
+    if (task->status == WAIT_REQUEST_TIMEOUT)
+      CancelTask(task);
+    Pin(task, share, version);
+    task->status = READY;
+    task->queue = ready_queue;
   }
+  AppendQueue(ready_queue, share->waiters);
+
+  while (!EmptyFifoQueue(share->requestQueue))
+  {
+    task = GetObj(share->requestQueue);
+    if (task->status != WAIT_REQUEST && task->status != WAIT_REQUEST_TIMEOUT)
+      continue;
+    if (task->status == WAIT_REQUEST_TIMEOUT)
+      CancelTask(task);
+    Pin(task, share, version);
+    task->status = READY;
+    PutTask(ready_queue, task);
+  }
+}
+
+/**
+ * Publishes a version that does not wait for its releases, or withdraws the
+ * current one if data is NULL.
+ */
+static void PublishVersion(Share *share, char *data, void (*retire)(char *data))
+{
+  if (data == NULL)
+    Publish(share, NULL);
   else
   {
-    PushObj(t->requestQueue, nCurrentTask());
-    nPrintf("%s%sAdded %s to %s's send queue\n", DEBUG, context, nGetTaskName(),
-            t->taskname);
-    if (timeout > 0)
+    Version *version = MakeVersion(data, retire);
+    Publish(share, version);
+    AnswerRequests(share, version);
+  }
+}
+
+static unsigned HashKey(const char *key)
+{
+  unsigned hash = 2166136261u; // FNV-1a
+  while (*key != 0)
+    hash = (hash ^ (unsigned char)*key++) * 16777619u;
+  return hash;
+}
+
+/**
+ * Doubles the number of buckets of the registry.
+ */
+static void GrowNamed()
+{
+  int size = namedSize == 0 ? 16 : 2 * namedSize;
+  Named **table = (Named **)nMalloc(size * sizeof(Named *));
+  int i;
+
+  for (i = 0; i < size; i++)
+    table[i] = NULL;
+  for (i = 0; i < namedSize; i++)
+    while (namedTable[i] != NULL)
     {
-      nCurrentTask()->status = WAIT_SEND_TIMEOUT;
-      ProgramTask(timeout);
+      Named *named = namedTable[i];
+      namedTable[i] = named->next;
+      named->next = table[named->hash & (size - 1)];
+      table[named->hash & (size - 1)] = named;
+    }
+  if (namedTable != NULL)
+    nFree(namedTable);
+  namedTable = table;
+  namedSize = size;
+}
+
+/**
+ * Looks up a key in the registry. If it is not there and create is TRUE, a new
+ * entry is added, otherwise NULL is returned.
+ */
+static Named *FindNamed(const char *key, int create)
+{
+  unsigned hash = HashKey(key);
+  Named *named;
+
+  if (namedSize > 0)
+    for (named = namedTable[hash & (namedSize - 1)]; named != NULL; named = named->next)
+      if (named->hash == hash && strcmp(named->key, key) == 0)
+        return named;
+  if (!create)
+    return NULL;
+
+  if (namedCount >= namedSize)
+    GrowNamed();
+  named = (Named *)SlabAlloc(&named_cache);
+  named->hash = hash;
+  named->key = (char *)nMalloc(strlen(key) + 1);
+  strcpy(named->key, key);
+  InitShare(&named->share, NULL);
+  named->next = namedTable[hash & (namedSize - 1)];
+  namedTable[hash & (namedSize - 1)] = named;
+  namedCount++;
+  return named;
+}
 
-      nPrintf("%s%s%s started a request with timeout: %d\n", DEBUG, context, nGetTaskName(),
-              timeout);
+/**
+ * Removes an entry from the registry once nothing is shared, held or requested
+ * through it.
+ */
+static void CollectNamed(Named *named)
+{
+  Share *share = &named->share;
+  Named **pnamed;
+
+  if (share->current != NULL || share->last != NULL || share->pinned > 0 ||
+      !EmptyQueue(share->waiters) || !EmptyFifoQueue(share->requestQueue))
+    return;
+
+  pnamed = &namedTable[named->hash & (namedSize - 1)];
+  while (*pnamed != named)
+    pnamed = &(*pnamed)->next;
+  *pnamed = named->next;
+  namedCount--;
+  DestroyQueue(share->waiters);
+  DestroyFifoQueue(share->requestQueue);
+  nFree(named->key);
+  SlabFree(&named_cache, named);
+}
+
+/**
+ * Expiration of the timeout of a task waiting in Share.waiters: the task leaves
+ * the list, so that AnswerRequests can move the list as a whole.
+ */
+static void RequestTimeout(Timer *timer)
+{
+  nTask task = (nTask)((char *)timer - offsetof(struct Task, timer));
+
+  DeleteTaskQueue(task->queue, task);
+  task->status = READY;
+  PushTask(ready_queue, task);
+}
+
+/**
+ * Waits in the request queues of n shares until one of them shares or the timeout
+ * expires. A single share is waited on through its intrusive list. Several shares
+ * use their FifoQueues: the first answer makes the current task READY, so the
+ * others skip it in AnswerRequests, and it is taken out of their queues once it
+ * runs again. Must be called inside a critical section.
+ *
+ * @return the hold on the answer, or NULL if the timeout expired.
+ */
+static Hold *WaitShare(Share **shares, int n, int timeout)
+{
+  nTask this_task = nCurrentTask();
+  Hold *before = this_task->holds;
+  int i;
+
+  for (i = 0; i < n; i++)
+  {
+    if (n == 1)
+      PutTask(shares[i]->waiters, this_task);
+    else
+      PutObj(shares[i]->requestQueue, this_task);
+    if (shares[i]->lazy)
+    { // The owner is in nShareLazy, it may produce the data now
+      shares[i]->lazy = FALSE;
+      shares[i]->owner->status = READY;
+      PushTask(ready_queue, shares[i]->owner);
     }
+  }
+  if (timeout > 0)
+  {
+    this_task->status = WAIT_REQUEST_TIMEOUT;
+    if (n == 1)
+      ProgramTimer(&this_task->timer, timeout, RequestTimeout);
+    else
+      ProgramTask(timeout);
+  }
+  else
+    this_task->status = WAIT_REQUEST;
+  ResumeNextReadyTask();
+
+  if (n > 1)
+    for (i = 0; i < n; i++)
+      DeleteObj(shares[i]->requestQueue, this_task);
+  return this_task->holds == before ? NULL : this_task->holds;
+}
+#pragma endregion
+
+/**
+ * Common part of the requests to a single share, called inside a critical
+ * section.
+ * A negative max_age never uses the cached last-shared value, and a non positive
+ * lease never expires.
+ */
+static char *Request(Share *share, int max_age, int timeout, int lease)
+{
+  nTask this_task;
+  char *data = NULL;
+
+  this_task = nCurrentTask();
+  this_task->lease = lease;
+
+  if (share->current != NULL)
+  {
+    Pin(this_task, share, share->current);
+    data = share->current->data;
+    LOG(REQUEST_HIT, share, data, 0);
+  }
+  else if (share->last != NULL && max_age >= 0 &&
+           nGetTime() - share->last_time <= max_age)
+  {
+    Pin(this_task, share, share->last);
+    data = share->last->data;
+    LOG(REQUEST_FRESH, share, data, nGetTime() - share->last_time);
+  }
+  else
+  {
+    Hold *hold;
+
+    LOG(REQUEST_WAIT, share, timeout, 0);
+    hold = WaitShare(&share, 1, timeout);
+    if (hold == NULL)
+      LOG(REQUEST_TIMEOUT, share, timeout, 0);
     else
     {
-      nCurrentTask()->status = WAIT_SEND;
-      nPrintf("%s%s%s started a request without timeout\n", DEBUG, context,
-              nGetTaskName());
+      data = hold->version->data;
+      LOG(REQUEST_ANSWER, share, data, 0);
     }
-    ResumeNextReadyTask();
   }
+  this_task->lease = 0;
+  return data;
+}
+
+/**
+ * Common part of nRelease and nReleaseNamed, called inside a critical section.
+ * share is NULL if nobody ever shared or requested through it.
+ */
+static void Release(Share *share, const char *name)
+{
+  Hold **phold, **pfound = NULL;
+  Hold *hold;
+  nTask owner;
 
-  if (t->status != WAIT_REPLY)
+  // Releases match requests in order, so a late nRelease finds its expired hold
+  // even if the task requested again from the same share
+  for (phold = &nCurrentTask()->holds; *phold != NULL; phold = &(*phold)->next)
+    if ((*phold)->share == share)
+      pfound = phold;
+
+  if (share == NULL || pfound == NULL)
   {
-    nPrintf("%s%s%s was READY, %s returns no answer.\n", DEBUG, context, t->taskname,
-            nGetTaskName());
-    return NULL;
+    LOG(RELEASE_UNMATCHED, share, 0, 0);
+    nFprintf(2, "Warning: nRelease without a request to %s\n",
+             name != NULL ? name : "this task");
+    return;
   }
 
-  END_CRITICAL();
-  nPrintf("%s%s%s received the following answer: %X.\n", DEBUG, context, nGetTaskName(),
-          (char *)nCurrentTask()->send.msg);
-  t->send.msg = nCurrentTask()->send.msg;
-  return (char *)nCurrentTask()->send.msg;
+  hold = *pfound;
+  *pfound = hold->next;
+  owner = FreeHold(hold);
+  LOG(RELEASE, share, share->pinned, 0);
+  if (owner != NULL)
+  { // The owner is in nShare waiting for this release
+    LOG(RELEASE_WAKE, share, owner, 0);
+    WakeTask(owner, wake_policy);
+  }
 }
 
-/** 
- * Notifies that the current task finished using the data.
- * 
+/**
+ * Requests data from a task.
+ * If there is an active share task, then the request returns its answer, otherwise it
+ * waits until a task shares information or for a certain amount of time elapses.
+ *
  * @param t
- *    the task to be notified
+ *    the task that will share information.
+ * @param timeout
+ *    the time the request waits for a response, or a non positive value to wait
+ *    forever.
+ * @return the shared data, or NULL if the timeout expired.
 */
-void nRelease(nTask t)
+char *nRequest(nTask t, int timeout)
+{
+  char *data;
+
+  START_CRITICAL();
+  data = Request(GetShare(t), -1, timeout, 0);
+  END_CRITICAL();
+  return data;
+}
+
+/**
+ * Requests data from a task, accepting the last value it shared if that value is
+ * at most max_age milliseconds old.
+ * The cached value is held like any other answer, so it must be released with
+ * nRelease. Data shared with nShare must stay valid for max_age milliseconds after
+ * nShare returns; data shared with nShareVersion is valid until it is retired.
+ *
+ * @param t
+ *    the task that shares the information.
+ * @param max_age
+ *    how old, in milliseconds, the cached value may be.
+ * @param timeout
+ *    the time to wait for a fresh share when the cached value is too old, or a non
+ *    positive value to wait forever.
+ * @return the shared data, or NULL if the timeout expired.
+ */
+char *nRequestFresh(nTask t, int max_age, int timeout)
 {
-  const char *context = "[nRelease]   ";
+  char *data;
 
   START_CRITICAL();
-  nSetTaskName("RELEASE %d", nReleaseCounter++);
+  data = Request(GetShare(t), max_age, timeout, 0);
+  END_CRITICAL();
+  return data;
+}
+
+/**
+ * Requests data from a task like nRequest, but holds it for at most lease
+ * milliseconds. If nRelease has not been called when the lease expires the data
+ * is released anyway, so a stalled requester does not keep the sharing task
+ * blocked in nShare. The late nRelease is still required and does nothing else.
+ * Expired leases are counted by nGetExpiredLeases.
+ *
+ * @param t
+ *    the task that shares the information.
+ * @param timeout
+ *    the time to wait for a share, or a non positive value to wait forever.
+ * @param lease
+ *    how long, in milliseconds, the data may be held once received.
+ * @return the shared data, or NULL if the timeout expired.
+ */
+char *nRequestLease(nTask t, int timeout, int lease)
+{
+  char *data;
+
+  if (lease <= 0)
+    nFatalError("nRequestLease", "The lease must be positive\n");
+  START_CRITICAL();
+  data = Request(GetShare(t), -1, timeout, lease);
+  END_CRITICAL();
+  return data;
+}
 
-  if (t->status != WAIT_REPLY)
+/**
+ * Returns how many leases of nRequestLease expired before their nRelease.
+ */
+int nGetExpiredLeases()
+{
+  return expiredLeases;
+}
+
+/**
+ * Requests data from whichever of n tasks shares first.
+ * If some of them is sharing already, its data is returned at once. Otherwise the
+ * request waits on all of them and is withdrawn from the rest when the first one
+ * answers. The data must be released with nRelease(tasks[*which]).
+ *
+ * @param tasks
+ *    the tasks that may share the information.
+ * @param n
+ *    the number of tasks.
+ * @param timeout
+ *    the time to wait for an answer, or a non positive value to wait forever.
+ * @param which
+ *    receives the index in tasks of the task that answered; left unchanged if the
+ *    timeout expired.
+ * @return the shared data, or NULL if the timeout expired.
+ */
+char *nRequestAny(nTask *tasks, int n, int timeout, int *which)
+{
+  nTask this_task;
+  Share **shares;
+  Hold *hold = NULL;
+  char *data = NULL;
+  int i;
+
+  if (n <= 0)
+    nFatalError("nRequestAny", "There must be at least one task to request from\n");
+  shares = (Share **)nMalloc(n * sizeof(Share *));
+
+  START_CRITICAL();
+  this_task = nCurrentTask();
+  for (i = 0; i < n; i++)
   {
-    nPrintf("%s%s%s is not waiting for a release.\n", ERROR, context, t->taskname);
+    shares[i] = GetShare(tasks[i]);
+    if (hold == NULL && shares[i]->current != NULL)
+    {
+      Pin(this_task, shares[i], shares[i]->current);
+      hold = this_task->holds;
+    }
   }
-  PushTask(ready_queue, nCurrentTask());
-  nPrintf("%s%sAdded %s to the ready queue\n", DEBUG, context, nGetTaskName());
-
-  if (--t->pendingRequests == 0)
+  if (hold == NULL)
+    hold = WaitShare(shares, n, timeout);
+  if (hold != NULL)
   {
-    t->status = READY;
-    nPrintf("%s%sAdded %s to the ready queue\n", DEBUG, context, t->taskname);
-    PushTask(ready_queue, t);
+    data = hold->version->data;
+    for (i = 0; i < n; i++)
+      if (shares[i] == hold->share)
+        *which = i;
   }
-  nPrintf("%s%s%s has %d pending requests\n", DEBUG, context, t->taskname,
-          t->pendingRequests);
+  END_CRITICAL();
 
-  ResumeNextReadyTask();
+  nFree(shares);
+
+  return data;
+}
 
+/**
+ * Notifies that the current task finished using the data.
+ *
+ * @param t
+ *    the task to be notified
+*/
+void nRelease(nTask t)
+{
+  START_CRITICAL();
+  Release(t->share, t->taskname);
   END_CRITICAL();
 }
 
 /**
  * Shares data.
  * When this function is called all the processes that made requests are unlocked.
- * 
+ * The function returns once every request that got the data has released it.
+ *
  * @param data
  *    los datos que serán compartidos
 */
 void nShare(char *data)
 {
+  Share *share;
+  Version *version;
+
   START_CRITICAL();
-  nSetTaskName("SHARE %d", nShareCounter++);
+  share = GetShare(nCurrentTask());
+  LOG(SHARE_BEGIN, share, data, 0);
+  version = MakeVersion(data, NULL);
+  Publish(share, version);
+  AnswerRequests(share, version);
 
-  char *context = "[nShare]     ";
-  nPrintf("%s%s%s started sharing %X\n", DEBUG, context, nGetTaskName(), data);
-  nPrintf("%s%sLooking for requests\n", DEBUG, context);
-  while (!EmptyFifoQueue(nCurrentTask()->requestQueue))
+  share->waiting = TRUE;
+  while (version->pins > 0)
   {
-    nTask requestingTask = GetObj(nCurrentTask()->requestQueue);
-    if (requestingTask->status == WAIT_SEND || requestingTask->status == WAIT_SEND_TIMEOUT)
-    {
-      if (requestingTask->status == WAIT_SEND_TIMEOUT)
-      {
-        CancelTask(requestingTask);
-        nPrintf("%s%sCancelling task %s because it was answered before it's timeout\n",
-                DEBUG, context, requestingTask->taskname);
-      }
-      requestingTask->status = READY;
-      requestingTask->send.msg = data;
-      PushTask(ready_queue, requestingTask);
-      nPrintf("%s%sAdded %s to the ready queue\n", DEBUG, context,
-              requestingTask->taskname);
-    }
+    nCurrentTask()->status = WAIT_REPLY;
+    ResumeNextReadyTask();
   }
-  while (nCurrentTask()->pendingRequests)
+  share->waiting = FALSE;
+  share->current = NULL; // version stays cached in share->last
+  LOG(SHARE_END, share, data, 0);
+  END_CRITICAL();
+}
+
+/**
+ * Shares data that is computed only when somebody asks for it.
+ * Waits until there is a pending request, then calls produce and shares its
+ * result with nShare, so every request that arrived in the meantime gets the same
+ * data. A publisher that loops on nShareLazy does no work while nobody requests.
+ * Requests answered by nRequestFresh from the cached value do not wake it.
+ *
+ * @param produce
+ *    computes the data; it runs in the current task, outside any critical
+ *    section, and may block.
+ * @param arg
+ *    passed to produce.
+ * @return the data that was shared, once every request that got it released it.
+ */
+char *nShareLazy(char *(*produce)(void *arg), void *arg)
+{
+  Share *share;
+  char *data;
+
+  START_CRITICAL();
+  share = GetShare(nCurrentTask());
+  while (EmptyQueue(share->waiters) && EmptyFifoQueue(share->requestQueue))
   {
-    nCurrentTask()->status = WAIT_REPLY;
-    nPrintf("%s%sWaiting for all requests to release the data\n", DEBUG, context);
+    share->lazy = TRUE;
+    nCurrentTask()->status = WAIT_LAZY;
     ResumeNextReadyTask();
+    share->lazy = FALSE;
   }
-  nPrintf("%s%s%s finished sharing\n", DEBUG, context, nGetTaskName());
   END_CRITICAL();
+
+  data = (*produce)(arg);
+  nShare(data);
+  return data;
+}
+
+/**
+ * Publishes a new version of the data and returns immediately.
+ * Waiting requesters get the new version, and so does every later nRequest until
+ * the next nShareVersion. The version it replaces stays valid for the tasks that
+ * hold it; after their last nRelease, retire is called with the old data so the
+ * publisher can free or reuse it. retire runs inside a critical section and must
+ * not block.
+ *
+ * @param data
+ *    the new version, or NULL to stop sharing.
+ * @param retire
+ *    called with data once the version is no longer used, may be NULL.
+ */
+void nShareVersion(char *data, void (*retire)(char *data))
+{
+  Share *share;
+
+  START_CRITICAL();
+  share = GetShare(nCurrentTask());
+  if (share->waiting)
+    nFatalError("nShareVersion", "Called from inside nShare\n");
+
+  PublishVersion(share, data, retire);
+  END_CRITICAL();
+}
+
+/**
+ * Publishes data under a name, like nShareVersion does for the current task.
+ * Every name has its own versions and request queue, so one task can publish
+ * many independent names, and requesters need only the name. A name is removed
+ * from the registry once it is withdrawn and nobody holds or requests it.
+ *
+ * @param key
+ *    the name.
+ * @param data
+ *    the new version, or NULL to stop sharing under key.
+ * @param retire
+ *    called with data once the version is no longer used, may be NULL.
+ */
+void nShareNamed(char *key, char *data, void (*retire)(char *data))
+{
+  Named *named;
+
+  START_CRITICAL();
+  named = FindNamed(key, data != NULL);
+  if (named != NULL)
+  {
+    PublishVersion(&named->share, data, retire);
+    CollectNamed(named);
+  }
+  END_CRITICAL();
+}
+
+/**
+ * Requests the data published under a name, waiting for it if nothing is
+ * published. The data must be released with nReleaseNamed.
+ *
+ * @param key
+ *    the name.
+ * @param timeout
+ *    the time to wait, or a non positive value to wait forever.
+ * @return the shared data, or NULL if the timeout expired.
+ */
+char *nRequestNamed(char *key, int timeout)
+{
+  Named *named;
+  char *data;
+
+  START_CRITICAL();
+  named = FindNamed(key, TRUE);
+  data = Request(&named->share, -1, timeout, 0);
+  if (data == NULL)
+    CollectNamed(named);
+  END_CRITICAL();
+  return data;
+}
+
+/**
+ * Notifies that the current task finished using the data it got from
+ * nRequestNamed.
+ *
+ * @param key
+ *    the name.
+ */
+void nReleaseNamed(char *key)
+{
+  Named *named;
+
+  START_CRITICAL();
+  named = FindNamed(key, FALSE);
+  Release(named == NULL ? NULL : &named->share, key);
+  if (named != NULL)
+    CollectNamed(named);
+  END_CRITICAL();
+}
+
+/**
+ * Sets the size of the stream ring of the current task, and the default size of
+ * the rings created afterwards. The stream keeps its sequence numbers; if it
+ * shrinks, the oldest values are dropped.
+ *
+ * @param size
+ *    how many of the last shared values nReadStream can return.
+ */
+void nSetStreamSize(int size)
+{
+  Stream *stream;
+  char **slots;
+  unsigned seq;
+
+  if (size <= 0)
+    nFatalError("nSetStreamSize", "The size must be positive\n");
+
+  START_CRITICAL();
+  streamSize = size;
+  stream = GetStream(GetShare(nCurrentTask()));
+  if (stream->next - stream->first > (unsigned)size)
+    stream->first = stream->next - size;
+  slots = (char **)nMalloc(size * sizeof(char *));
+  for (seq = stream->first; seq != stream->next; seq++)
+    slots[seq % size] = stream->slots[seq % stream->size];
+  nFree(stream->slots);
+  stream->slots = slots;
+  stream->size = size;
+  END_CRITICAL();
+}
+
+/**
+ * Reads the values a task shared, in order, without missing any as long as the
+ * reader keeps up. Every nShare, nShareVersion and nShareLazy of t adds its value
+ * to a ring of the last values (see nSetStreamSize) once the stream exists, that
+ * is, after the first nReadStream or nSetStreamSize on t. Values are not held:
+ * the publisher must keep the data of the values in the ring valid, for example
+ * by sharing a ring of buffers at least as large.
+ *
+ * @param t
+ *    the task that shares.
+ * @param seq
+ *    the sequence number of the first value wanted, 0 the first time; it is
+ *    advanced past the values returned.
+ * @param items
+ *    receives the values.
+ * @param max
+ *    the size of items.
+ * @param timeout
+ *    the time to wait when there is no value newer than *seq, or a non positive
+ *    value to wait forever.
+ * @return the number of values stored in items, 0 if the timeout expired, or -1
+ *    if the values from *seq on were overwritten before being read; then *seq is
+ *    moved to the oldest value still available.
+ */
+int nReadStream(nTask t, unsigned *seq, char **items, int max, int timeout)
+{
+  nTask this_task;
+  Stream *stream;
+  int n = 0, waited = FALSE;
+
+  START_CRITICAL();
+  this_task = nCurrentTask();
+  stream = GetStream(GetShare(t));
+  for (;;)
+  {
+    if ((int)(*seq - stream->first) < 0)
+    { // overrun
+      *seq = stream->first;
+      n = -1;
+      break;
+    }
+    if ((int)(stream->next - *seq) > 0)
+    {
+      while (n < max && *seq != stream->next)
+        items[n++] = stream->slots[(*seq)++ % stream->size];
+      break;
+    }
+    if (waited)
+      break; // the timeout expired
+
+    PutObj(stream->readers, this_task);
+    if (timeout > 0)
+    {
+      this_task->status = WAIT_STREAM_TIMEOUT;
+      ProgramTask(timeout);
+    }
+    else
+      this_task->status = WAIT_STREAM;
+    ResumeNextReadyTask();
+    DeleteObj(stream->readers, this_task);
+    waited = timeout > 0;
+  }
+  END_CRITICAL();
+  return n;
+}
+
+/**
+ * Frees the sharing state of a task that is being destroyed by nWaitTask. Data
+ * the task still holds is released, and its pending leases are cancelled.
+ */
+void DestroyShare(nTask t)
+{
+  Share *share = t->share;
+
+  while (t->holds != NULL)
+  {
+    Hold *hold = t->holds;
+    nTask owner;
+
+    t->holds = hold->next;
+    owner = FreeHold(hold);
+    if (owner != NULL)
+    {
+      owner->status = READY;
+      PushTask(ready_queue, owner);
+    }
+  }
+
+  if (share == NULL)
+    return;
+  if (!EmptyQueue(share->waiters) || !EmptyFifoQueue(share->requestQueue))
+    nFatalError("nWaitTask", "There are %d task(s) requesting from the dying task\n",
+                QueueLength(share->waiters) + LengthFifoQueue(share->requestQueue));
+  if (share->pinned > 0)
+    nFatalError("nWaitTask", "There are %d unreleased request(s) to the dying task\n",
+                share->pinned);
+  if (share->last != NULL)
+    RetireVersion(share->last);
+  if (share->stream != NULL)
+  {
+    if (!EmptyFifoQueue(share->stream->readers))
+      nFatalError("nWaitTask", "There are %d task(s) reading the stream of the dying"
+                  " task\n", LengthFifoQueue(share->stream->readers));
+    nFree(share->stream->slots);
+    DestroyFifoQueue(share->stream->readers);
+    SlabFree(&stream_cache, share->stream);
+  }
+  DestroyQueue(share->waiters);
+  DestroyFifoQueue(share->requestQueue);
+  SlabFree(&share_cache, share);
+  t->share = NULL;
 }
@@ -0,0 +1,428 @@
+/**
+ * nShare between processes: the data and the sharing state live in a POSIX shared
+ * memory segment, so several nSystem processes on the same host can share large
+ * snapshots without copying them.
+ *
+ * A waiting task never blocks its process. Every change that may unblock somebody
+ * increments a futex word in the segment. In each process a watcher thread waits
+ * on that futex and forwards the change to an eventfd, which a pump task reads
+ * with nRead and which wakes the local tasks that wait on the segment.
+ */
+#define _GNU_SOURCE
+#include "nSysimp.h"
+
+typedef struct Shm *nShm;
+#define NOVOID_NSHM
+
+#include <nSystem.h>
+
+#pragma GCC diagnostic ignored "-Wunknown-pragmas"
+
+#ifdef __linux__
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#pragma region : CONSTANTS
+#define SHM_MAGIC 0x6e53686d // "nShm"
+#define SHARING 0x80000000u  // state bit: the publisher is in nShmShare
+#define HEADER_SIZE 64       // the data starts on its own cache line
+#pragma endregion
+
+#pragma region : TYPES
+/**
+ * The start of the segment. Every field but magic and size is accessed with
+ * atomic operations, since other processes use it at the same time.
+ */
+typedef struct ShmHeader
+{
+  unsigned magic;    // SHM_MAGIC once the creator initialized the segment
+  int size;          // bytes of data after the header
+  unsigned state;    // SHARING while shared, plus the requests not yet released;
+                     // cleared by whoever sees the last request finish
+  unsigned waiting;  // requests waiting for the next share, in every process
+  unsigned event;    // futex word, changes when a waiting task may proceed
+  int len;           // bytes of the data being shared
+} ShmHeader;
+
+/**
+ * A segment opened by this process.
+ */
+struct Shm
+{
+  ShmHeader *header;
+  size_t mapSize;
+  int efd;            // the watcher signals changes of header->event here
+  pthread_t watcher;
+  int closing;        // TRUE once nShmClose started
+  nTask pump;
+  FifoQueue waiters;  // local tasks waiting on the segment
+};
+#pragma endregion
+
+#pragma region : LOCAL FUNCTIONS
+static int Futex(unsigned *word, int op, unsigned value)
+{
+  return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
+
+/**
+ * Tells every process that the state of the segment changed.
+ */
+static void Bump(ShmHeader *header)
+{
+  __atomic_add_fetch(&header->event, 1, __ATOMIC_SEQ_CST);
+  Futex(&header->event, FUTEX_WAKE, INT_MAX);
+}
+
+/**
+ * Ends the share if no request holds it or is on its way to it. Clearing SHARING
+ * here, and not when the publisher gets to run, keeps a requester in another
+ * process from getting the same data again right after releasing it.
+ */
+static void TryUnshare(ShmHeader *header)
+{
+  unsigned state = SHARING;
+  if (__atomic_load_n(&header->waiting, __ATOMIC_SEQ_CST) == 0 &&
+      __atomic_compare_exchange_n(&header->state, &state, 0, FALSE,
+                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    Bump(header);
+}
+
+/**
+ * The watcher thread: forwards every change of the futex word to the eventfd,
+ * and raises SIGIO so a running task does not delay the pump until the next
+ * time slice. All signals are blocked in this thread.
+ */
+static void *Watcher(void *arg)
+{
+  struct Shm *shm = arg;
+  unsigned seen = __atomic_load_n(&shm->header->event, __ATOMIC_SEQ_CST);
+
+  while (!__atomic_load_n(&shm->closing, __ATOMIC_SEQ_CST))
+  {
+    unsigned event = __atomic_load_n(&shm->header->event, __ATOMIC_SEQ_CST);
+    if (event == seen)
+    {
+      Futex(&shm->header->event, FUTEX_WAIT, event);
+      continue;
+    }
+    seen = event;
+    eventfd_write(shm->efd, 1);
+    kill(getpid(), SIGIO);
+  }
+  eventfd_write(shm->efd, 1);
+  return NULL;
+}
+
+/**
+ * The pump task: wakes the local waiters after every change. A waiter whose
+ * timeout already expired is ready but still in the FifoQueue; it is skipped.
+ */
+static int Pump(struct Shm *shm)
+{
+  eventfd_t count;
+
+  while (!shm->closing)
+  {
+    nRead(shm->efd, (char *)&count, sizeof(count));
+    START_CRITICAL();
+    while (!EmptyFifoQueue(shm->waiters))
+    {
+      nTask task = GetObj(shm->waiters);
+      if (task->status != WAIT_SHM && task->status != WAIT_SHM_TIMEOUT)
+        continue;
+      if (task->status == WAIT_SHM_TIMEOUT)
+        CancelTask(task);
+      task->status = READY;
+      PutTask(ready_queue, task);
+    }
+    END_CRITICAL();
+  }
+  return 0;
+}
+
+/**
+ * Waits for the next change of the segment, or at most timeout milliseconds if
+ * timeout is positive. Must be called inside a critical section.
+ */
+static void Wait(struct Shm *shm, int timeout)
+{
+  nTask this_task = nCurrentTask();
+
+  PutObj(shm->waiters, this_task);
+  if (timeout > 0)
+  {
+    this_task->status = WAIT_SHM_TIMEOUT;
+    ProgramTask(timeout);
+  }
+  else
+    this_task->status = WAIT_SHM;
+  ResumeNextReadyTask();
+  DeleteObj(shm->waiters, this_task);
+}
+
+/**
+ * Maps a segment of size bytes of data, creating and initializing it if it does
+ * not exist. Returns NULL on failure.
+ */
+static ShmHeader *MapSegment(char *name, int size, size_t *mapSize)
+{
+  size_t length = HEADER_SIZE + size;
+  ShmHeader *header;
+  struct stat st;
+  int created = TRUE;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+  if (fd < 0)
+  {
+    created = FALSE;
+    fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0)
+      return NULL;
+    do
+    { // the creator may not have sized it yet
+      if (fstat(fd, &st) < 0)
+      {
+        close(fd);
+        return NULL;
+      }
+      if ((size_t)st.st_size < HEADER_SIZE)
+        nSleep(1);
+    } while ((size_t)st.st_size < HEADER_SIZE);
+    length = st.st_size;
+  }
+  else if (ftruncate(fd, length) < 0)
+  {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  header = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (header == MAP_FAILED)
+    return NULL;
+
+  if (created)
+  {
+    header->size = size;
+    header->state = 0;
+    header->waiting = 0;
+    header->event = 0;
+    header->len = 0;
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_SEQ_CST);
+  }
+  else
+    while (__atomic_load_n(&header->magic, __ATOMIC_SEQ_CST) != SHM_MAGIC)
+      nSleep(1);
+  *mapSize = length;
+  return header;
+}
+#pragma endregion
+
+/**
+ * Opens a shared memory segment for nShmShare and nShmRequest, creating it if it
+ * does not exist. Every process opens it with the same name; the segment lives
+ * until it is removed with shm_unlink.
+ *
+ * @param name
+ *    the name of the segment, as for shm_open (e.g. "/snapshot").
+ * @param size
+ *    the bytes of data; ignored if the segment already exists.
+ * @return the segment, or NULL if it could not be opened (see errno).
+ */
+nShm nShmOpen(char *name, int size)
+{
+  struct Shm *shm;
+  ShmHeader *header;
+  size_t mapSize;
+  sigset_t all, old;
+  int efd;
+
+  header = MapSegment(name, size, &mapSize);
+  if (header == NULL)
+    return NULL;
+  efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd < 0)
+  {
+    munmap(header, mapSize);
+    return NULL;
+  }
+
+  shm = (struct Shm *)nMalloc(sizeof(struct Shm));
+  shm->header = header;
+  shm->mapSize = mapSize;
+  shm->efd = efd;
+  shm->closing = FALSE;
+  shm->waiters = MakeFifoQueue();
+
+  // The watcher inherits the mask: no signal of nSystem may reach it
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  if (pthread_create(&shm->watcher, NULL, Watcher, shm) != 0)
+    nFatalError("nShmOpen", "Cannot create the watcher thread\n");
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  shm->pump = nEmitTask(Pump, shm);
+  return shm;
+}
+
+/**
+ * Closes a segment opened with nShmOpen. No task of this process may be using it.
+ */
+void nShmClose(nShm shm)
+{
+  if (!EmptyFifoQueue(shm->waiters))
+    nFatalError("nShmClose", "There are %d task(s) waiting on the segment\n",
+                LengthFifoQueue(shm->waiters));
+  __atomic_store_n(&shm->closing, TRUE, __ATOMIC_SEQ_CST);
+  Bump(shm->header); // also wakes the watchers of other processes, harmless
+  pthread_join(shm->watcher, NULL);
+  nWaitTask(shm->pump);
+  close(shm->efd);
+  munmap(shm->header, shm->mapSize);
+  DestroyFifoQueue(shm->waiters);
+  nFree(shm);
+}
+
+/**
+ * Returns the data area of the segment. The publisher fills it before nShmShare
+ * and may change it again once nShmShare returns.
+ */
+char *nShmData(nShm shm)
+{
+  return (char *)shm->header + HEADER_SIZE;
+}
+
+/**
+ * Returns the size of the data area of the segment.
+ */
+int nShmSize(nShm shm)
+{
+  return shm->header->size;
+}
+
+/**
+ * Returns the number of bytes of the data being shared, as given to nShmShare.
+ */
+int nShmLength(nShm shm)
+{
+  return __atomic_load_n(&shm->header->len, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Shares the first len bytes of the data area, like nShare: every request that is
+ * waiting, in any process, gets the data, and nShmShare returns once all of them
+ * released it. Only one task at a time may share through a segment. Other tasks
+ * of the process keep running meanwhile.
+ */
+void nShmShare(nShm shm, int len)
+{
+  ShmHeader *header = shm->header;
+
+  if (len < 0 || len > header->size)
+    nFatalError("nShmShare", "Invalid length %d\n", len);
+
+  START_CRITICAL();
+  __atomic_store_n(&header->len, len, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&header->state, SHARING, __ATOMIC_SEQ_CST);
+  Bump(header);
+
+  // Done when no request is still on its way to the data and none holds it
+  TryUnshare(header);
+  while (__atomic_load_n(&header->state, __ATOMIC_SEQ_CST) & SHARING)
+    Wait(shm, -1);
+  END_CRITICAL();
+}
+
+/**
+ * Requests the data shared through a segment, like nRequest. The data is at
+ * nShmData(shm), its length is nShmLength(shm), and it must be released with
+ * nShmRelease.
+ *
+ * @param shm
+ *    the segment.
+ * @param timeout
+ *    the time to wait for a share, or a non positive value to wait forever.
+ * @return the shared data, or NULL if the timeout expired.
+ */
+char *nShmRequest(nShm shm, int timeout)
+{
+  ShmHeader *header = shm->header;
+  int deadline = nGetTime() + timeout;
+  int registered = FALSE;
+  char *data = NULL;
+
+  START_CRITICAL();
+  for (;;)
+  {
+    unsigned state = __atomic_load_n(&header->state, __ATOMIC_SEQ_CST);
+    if (state & SHARING)
+    {
+      if (__atomic_compare_exchange_n(&header->state, &state, state + 1, FALSE,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      {
+        data = nShmData(shm);
+        break;
+      }
+    }
+    else if (!registered)
+    { // From now on the publisher waits for this request; check again
+      __atomic_add_fetch(&header->waiting, 1, __ATOMIC_SEQ_CST);
+      registered = TRUE;
+    }
+    else if (timeout <= 0)
+      Wait(shm, -1);
+    else if (deadline - nGetTime() > 0)
+      Wait(shm, deadline - nGetTime());
+    else
+      break; // the timeout expired
+  }
+  if (registered && __atomic_sub_fetch(&header->waiting, 1, __ATOMIC_SEQ_CST) == 0)
+    TryUnshare(header);
+  END_CRITICAL();
+  return data;
+}
+
+/**
+ * Notifies that the current task finished using the data of nShmRequest.
+ */
+void nShmRelease(nShm shm)
+{
+  ShmHeader *header = shm->header;
+  unsigned state;
+
+  START_CRITICAL();
+  state = __atomic_load_n(&header->state, __ATOMIC_SEQ_CST);
+  if (!(state & SHARING) || state == SHARING)
+    nFatalError("nShmRelease", "The segment is not being shared with a request\n");
+  if (__atomic_sub_fetch(&header->state, 1, __ATOMIC_SEQ_CST) == SHARING)
+    TryUnshare(header);
+  END_CRITICAL();
+}
+
+#else /* ! __linux__ */
+
+nShm nShmOpen(char *name, int size)
+{
+  nFatalError("nShmOpen", "Shared memory sharing needs Linux\n");
+  return NULL;
+}
+
+void nShmClose(nShm shm) {}
+char *nShmData(nShm shm) { return NULL; }
+int nShmSize(nShm shm) { return 0; }
+int nShmLength(nShm shm) { return 0; }
+void nShmShare(nShm shm, int len) {}
+char *nShmRequest(nShm shm, int timeout) { return NULL; }
+void nShmRelease(nShm shm) {}
+
+#endif
@@ -6,7 +6,15 @@
 
 # Ojo!! Los argumentos en asm de 64bits se pasan por los
 # registros si son de tipo entero o puntero
-	
+
+# Solo se guardan los registros que el ABI SysV exige preservar a
+# traves de una llamada (rbp, rbx, r12-r15) mas MXCSR y la palabra de
+# control del x87.  Los demas ya los da por perdidos el llamador.
+# El marco guardado es (desde el sp guardado hacia arriba):
+#   mxcsr (4 bytes), control x87 (2 bytes), relleno (2 bytes),
+#   r15, r14, r13, r12, rbx, rbp, direccion de retorno
+# y debe coincidir con el de ChangeContext en nSysimp.h.
+
 # void* CallInNewStack(int **psp, int *newsp, void (*proc)(), void *ptr)
 # rdi = psp
 # rsi = newsp
@@ -14,63 +22,47 @@
 # rcx = ptr
 _CallInNewStack:
 	pushq	%rbp
-	movq	%rsp, %rbp
 	pushq	%rbx
-	pushq	%rcx
-	pushq	%r8
-	pushq	%r9
-	pushq	%r10
-	pushq	%r11
 	pushq	%r12
 	pushq	%r13
 	pushq	%r14
 	pushq	%r15
-	
-#	movq	%rdi, -8(%rbp)
-#	movq	%rsi, -16(%rbp)
-#	movq	%rdx, -24(%rbp)
-#	movq	%rcx, -32(%rbp)
-	movq	%rdi, %rax
-	movq	%rsp, (%rax) 	# *psp = rsp
+	subq	$8, %rsp
+	stmxcsr	(%rsp)
+	fnstcw	4(%rsp)
+
+	movq	%rsp, (%rdi) 	# *psp = rsp
 	movq	%rsi, %rsp	# rsp = newsp
 	movq	%rcx, %rdi	# arg1 = ptr;
 	call	*%rdx
 	ret
 
-# void *ChangeToStack(int **psp, int **pspnew, void *pret)
+# void ChangeToStack(int **psp, int **pspnew)
 # rdi : psp
 # rsi : pspnew
-# rdx : pret
-# no sirve guardarlos...
 _ChangeToStack:
 	pushq	%rbp
-	movq	%rsp, %rbp
 	pushq	%rbx
-	pushq	%rcx
-	pushq	%r8
-	pushq	%r9
-	pushq	%r10
-	pushq	%r11
 	pushq	%r12
 	pushq	%r13
 	pushq	%r14
 	pushq	%r15
-	
-#	movq	%rdi, -8(%rbp) 	# psp
-#	movq	%rsi, -16(%rbp)	# pspnew
-#	movq	%rdx, -24(%rbp) # pret
-	movq	%rsp, (%rdi)	# *psp = rsp	
+	subq	$8, %rsp
+	stmxcsr	(%rsp)
+	fnstcw	4(%rsp)
+
+	movq	%rsp, (%rdi)	# *psp = rsp
 	movq	(%rsi), %rsp	# rsp = *sp
-	movq	%rdx, %rax	#
+
+	ldmxcsr	(%rsp)
+	fldcw	4(%rsp)
+	addq	$8, %rsp
 	popq	%r15
 	popq	%r14
 	popq	%r13
 	popq	%r12
-	popq	%r11
-	popq	%r10
-	popq	%r9
-	popq	%r8
-	popq	%rcx
 	popq	%rbx
 	popq	%rbp
 	ret
+
+	.section .note.GNU-stack,"",@progbits
@@ -4,34 +4,63 @@
 #include <signal.h>
 #include "fifoqueues.h"
 
+/*************************************************************
+ * Timers (ver nTime.c)
+ *************************************************************/
+
+typedef struct Timer
+{
+  struct Timer *next;   /* Siguiente timer en la misma ranura */
+  struct Timer **pprev; /* El enlace que apunta a este timer */
+                        /* (NULL si no esta programado) */
+  int wake_time;        /* Tiempo de vencimiento */
+  void (*expire)(struct Timer *timer);
+                        /* Se invoca al vencer (dentro de un handler) */
+}
+  Timer;
+
 /*************************************************************
  * nProcess.c
  *************************************************************/
 
 typedef void **SP;  /* Punteros a pilas */
 
+#define CACHE_LINE 64 /* Taman~o de una linea del cache */
+
+/* Los campos que se consultan en cada cambio de contexto y en cada
+ * operacion sobre colas van primero, en la misma linea del cache.
+ */
+
 typedef struct Task /* Descriptor de una tarea */
 {
   int status;       /* Estado de la tarea (READY, ZOMBIE ...) */
-  char *taskname;   /* Util para hacer debugging */
-
   SP sp;            /* El stack pointer cuando esta suspendida */
-  SP stack;         /* El stack */
-
   struct Task *next_task;   /* Se usa cuando esta en una cola */
   void *queue;              /* Debugging */
 
+  SP stack;         /* El stack */
+  int stack_size;   /* Su taman~o (para devolverlo al pool) */
+  char *taskname;   /* Util para hacer debugging */
+
   /* Para el nExitTask y nWaitTask */
   int  rc;                  /* codigo de retorno de la tarea  */
   struct Task *waitTask;   /* La tarea que espera un nExitTask */
 
   struct Queue *send_queue; /* cola de emisores en espera de esta tarea */
   /* Para nSend, nReceive y nReply */
-  FifoQueue requestQueue;
   union { void *msg; int rc; } send; /* sirve para intercambio de info */
-  int wake_time;            /* Tiempo maximo de espera de un nReceive */
-  size_t pendingRequests;
-}
+  unsigned send_seq;        /* Nro. de llegada del nSend al receptor */
+  unsigned arrivals;        /* Contador de llegadas (nSend y nPost) */
+  struct Mailbox *mailbox;  /* Los mensajes de nPost (NULL si no hay) */
+  Timer timer;              /* Timeout de un nReceive, nSleep, etc. */
+  int timed_out;            /* Vencio el ProgramQueueTask (ver nTime.c) */
+  int *wait_addr;           /* La direccion de un nWaitOnAddress */
+
+  /* Para nShare, nRequest y nRelease */
+  struct Share *share;      /* Lo que comparte esta tarea (NULL si nada) */
+  struct Hold *holds;       /* Los datos que pidio y no ha liberado */
+  int lease;                /* Plazo para liberar lo que esta pidiendo */
+} __attribute__((aligned(CACHE_LINE)))
   *nTask;
 
 #define NOVOID_NTASK
@@ -50,16 +79,41 @@ typedef struct Task /* Descriptor de una tarea */
 #define WAIT_SEM   8  /* esta bloqueada en un semaforo (nWaitSem) */
 #define WAIT_MON   9  /* esta bloqueada en un monitor (nEnterMonitor)*/
 #define WAIT_COND 10  /* esta bloqueada en una condicion (nWaitCondition) */
-#define WAIT_COND_TIMEOUT 11 /*esta bloqueado en un monitor con timeout */
+#define WAIT_COND_TIMEOUT 11 /* en una condicion con timeout (nWaitConditionTimeout) */
 #define WAIT_SLEEP 12 /* esta dormida en nSleep */
-
-#define STATUS_END WAIT_SLEEP
+#define WAIT_POST 13  /* espera espacio en un buzon lleno (nPost) */
+#define WAIT_LOG  14  /* la tarea del log espera registros (nLog.c) */
+#define WAIT_RLOCK 15 /* espera un candado para leer (nReadLock) */
+#define WAIT_WLOCK 16 /* espera un candado para escribir (nWriteLock) */
+#define WAIT_SEM_TIMEOUT 17   /* nWaitSemTimeout */
+#define WAIT_MON_TIMEOUT 18   /* nEnterTimeout */
+#define WAIT_REPLY_TIMEOUT 19 /* nSendTimeout antes del nReceive */
+#define WAIT_TASK_TIMEOUT 20  /* nWaitTaskTimeout */
+#define WAIT_ADDR 21          /* espera un nWakeAddress (nWaitOnAddress) */
+#define WAIT_ADDR_TIMEOUT 22  /* nWaitOnAddress con timeout */
+#define WAIT_REQUEST 23       /* espera un nShare (nRequest, nShare.c) */
+#define WAIT_REQUEST_TIMEOUT 24 /* nRequest con timeout */
+#define WAIT_LAZY 25          /* espera un nRequest (nShareLazy) */
+#define WAIT_STREAM 26        /* espera otro valor (nReadStream) */
+#define WAIT_STREAM_TIMEOUT 27 /* nReadStream con timeout */
+#define WAIT_SHM 28           /* espera un cambio del segmento (nShareShm.c) */
+#define WAIT_SHM_TIMEOUT 29   /* nShmRequest con timeout */
+
+#define STATUS_END WAIT_SHM_TIMEOUT
 
 /* Agregar nuevos estados como STATUS_END+1, STATUS_END+2, ... */
 
 #define STATUS_LIST {"READY", "ZOMBIE", "WAIT_TASK", "WAIT_REPLY", \
                      "WAIT_SEND", "WAIT_SEND_TIMEOUT", "WAIT_READ", \
-                     "WAIT_WRITE", "WAIT_SEM", "WAIT_MON", "WAIT_COND" }
+                     "WAIT_WRITE", "WAIT_SEM", "WAIT_MON", "WAIT_COND", \
+                     "WAIT_COND_TIMEOUT", "WAIT_SLEEP", "WAIT_POST", \
+                     "WAIT_LOG", "WAIT_RLOCK", "WAIT_WLOCK", \
+                     "WAIT_SEM_TIMEOUT", "WAIT_MON_TIMEOUT", \
+                     "WAIT_REPLY_TIMEOUT", "WAIT_TASK_TIMEOUT", \
+                     "WAIT_ADDR", "WAIT_ADDR_TIMEOUT", "WAIT_REQUEST", \
+                     "WAIT_REQUEST_TIMEOUT", "WAIT_LAZY", \
+                     "WAIT_STREAM", "WAIT_STREAM_TIMEOUT", "WAIT_SHM", \
+                     "WAIT_SHM_TIMEOUT" }
 
 /*
  * Prologo y Epilogo:
@@ -72,11 +126,17 @@ void ProcessEnd();
  * Para el Scheduler:
  */
 
-extern struct Queue *ready_queue;   /* Cola de tareas en espera de la CPU */
-extern nTask current_task;  /* La tarea que tiene la CPU */
+/* En modo M:N (ver nSetWorkers en nProcess.c) cada thread del nucleo
+ * es un ``worker'' con su propia cola ready, su tarea actual y su
+ * estado, por eso son variables __thread.  Con un solo worker todo
+ * ocurre en el thread del proceso Unix, como siempre.
+ */
+
+extern __thread struct Queue *ready_queue; /* Tareas en espera de la CPU */
+extern __thread nTask current_task; /* La tarea que tiene la CPU */
 extern int current_slice;   /* Taman~o de una tajada de CPU */
 
-extern int cpu_status;      /* Estados del procesador */
+extern __thread int cpu_status; /* Estados del procesador */
 
 #define RUNNING 0           /* Corre alguna tarea */
 #define WAIT_INTERRUPT 1    /* Ciclo de espera dentro de ResumeNextReadyTask */
@@ -86,24 +146,53 @@ extern int cpu_status;      /* Estados del procesador */
 /* Suspende la tarea actual y retoma la primera de la ``ready_queue'' */
 void ResumeNextReadyTask();
 
+/* Suspende la tarea actual y retoma next_task, que no esta en la cola */
+void SwitchToTask(nTask next_task);
+
+/* Pasa task a READY segun la politica WAKE_... (ver nProcess.c) */
+extern int wake_policy;     /* La de nSetWakePolicy */
+void WakeTask(nTask task, int policy);
+
 /* Para la entrada y salida de handlers */
 void PreemptTask();
 void ResumePreemptive();
 
+/* Modo M:N */
+extern int workers;         /* Nro. de workers (1 si no hay modo M:N) */
+void KickWorkers();         /* Despierta a un worker ocioso si hay trabajo */
+
 /*************************************************************
  * nTime.c
  *************************************************************/
 
 void TimeInit();
 void TimeEnd();
-void ProgramTask(int timeout);
-void CancelTask(nTask task);
+void ProgramTask(int timeout); /* Despierta current_task tras timeout */
+void CancelTask(nTask task);   /* Anula el ProgramTask de task */
+void ProgramQueueTask(int timeout); /* Ademas la saca de su cola */
+
+/* Programa un timer cualquiera: al vencer se invoca expire(timer) */
+void ProgramTimer(Timer *timer, int timeout, void (*expire)(Timer *));
+void CancelTimer(Timer *timer);
 
 /*************************************************************
  * nMsg.c
  *************************************************************/
 
 void MsgEnd();
+void DestroyMailbox(nTask task); /* Libera el buzon de una tarea que muere */
+
+/*************************************************************
+ * nShare.c
+ *************************************************************/
+
+void DestroyShare(nTask task); /* Libera lo que compartia una tarea que muere */
+
+/*************************************************************
+ * nLog.c (los eventos se anotan con LOG, ver nLog.h)
+ *************************************************************/
+
+void LogEnd(); /* Escribe lo que quede en el anillo del log */
 
 /*************************************************************
  * nIO-sysv.c
@@ -112,6 +201,18 @@ void MsgEnd();
 void IOInit();
 void IOEnd();
 
+/* Espera en epoll hasta que haya E/S lista o llegue una senal no
+ * bloqueada en mask.  Lo usa WaitSignal en vez de sigsuspend.
+ */
+void WaitIO(sigset_t *mask);
+
+/* Recoge las operaciones de io_uring terminadas, sin bloquearse */
+void ReapIO();
+
+/* Modo M:N: un eventfd en epoll para despertar a los workers ociosos */
+void KickInit();
+void KickIO();
+
 /*************************************************************
  * nDep-sysv.c
  *************************************************************/
@@ -139,11 +240,86 @@ void EndHandler();
 /* Debugging: Verifica que se este dentro de una seccion critica */
 void VerifyCritical(char *str);
 
+/* En modo M:N la seccion critica mas externa de cada thread toma un
+ * candado global.  WaitIO lo suelta mientras espera en epoll.
+ */
+void LockWorkers();
+void UnlockWorkers();
+
 /*
  * Cambios de contexto explicitos
  */
 
+extern __thread volatile sig_atomic_t sig_level;
+                            /* Anidamiento de secc. criticas */
+
+#if defined(__x86_64__) && !defined(NO_INLINE_SWITCH)
+
+/* En amd64 el cambio de stack se expande en linea dentro de
+ * ResumeNextReadyTask.  Se guardan solo los registros que el ABI
+ * exige preservar mas MXCSR y el control del x87, con el mismo marco
+ * que _ChangeToStack y _CallInNewStack en nStack-amd64.s.  Los
+ * registros que el ABI no preserva se declaran destruidos para que
+ * el compilador no los mantenga vivos a traves del cambio.
+ * Se bajan 128 bytes antes de apilar para no pisar la ``red zone''.
+ * Se retoma con jmp y no con ret: no hubo un call que calce con ese
+ * ret y el predictor de retornos fallaria en este y en los siguientes.
+ */
+
+static inline __attribute__((always_inline))
+void ChangeContext(nTask this_task, nTask next_task)
+{
+  int curr_sig_level= sig_level;
+  SP *psp= &this_task->sp;
+  SP *pnext_sp= &next_task->sp;
+
+  __asm__ __volatile__(
+    "subq   $128, %%rsp\n\t"
+    "leaq   1f(%%rip), %%rax\n\t"
+    "pushq  %%rax\n\t"
+    "pushq  %%rbp\n\t"
+    "pushq  %%rbx\n\t"
+    "pushq  %%r12\n\t"
+    "pushq  %%r13\n\t"
+    "pushq  %%r14\n\t"
+    "pushq  %%r15\n\t"
+    "subq   $8, %%rsp\n\t"
+    "stmxcsr (%%rsp)\n\t"
+    "fnstcw 4(%%rsp)\n\t"
+    "movq   %%rsp, (%0)\n\t"
+    "movq   (%1), %%rsp\n\t"
+    "ldmxcsr (%%rsp)\n\t"
+    "fldcw  4(%%rsp)\n\t"
+    "addq   $8, %%rsp\n\t"
+    "popq   %%r15\n\t"
+    "popq   %%r14\n\t"
+    "popq   %%r13\n\t"
+    "popq   %%r12\n\t"
+    "popq   %%rbx\n\t"
+    "popq   %%rbp\n\t"
+    "popq   %%rax\n\t"
+    "jmp    *%%rax\n"
+    "1:\n\t"
+    "addq   $128, %%rsp"
+    : "+D" (psp), "+S" (pnext_sp)
+    :
+    : "rax", "rcx", "rdx", "r8", "r9", "r10", "r11", "memory", "cc",
+      "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+      "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+      "st", "st(1)", "st(2)", "st(3)", "st(4)", "st(5)", "st(6)", "st(7)");
+
+  /* Se restaura el nivel de anidamiento de secciones criticas, puesto
+   * que pueden diferir en ambos contextos (tareas).
+   */
+  sig_level= curr_sig_level;
+}
+
+#else
+
 void ChangeContext(nTask this_task, nTask next_task);
+
+#endif
+
 void CallInNewContext(nTask this_task, nTask new_task,
                       void (*proc)(), void *ptr);
 
@@ -199,6 +375,39 @@ void SetAlarm(int type, int msecs, void (*timerhandler)());
 void MarkStack(SP sp);
 void CheckStack(SP sp);
 
+/*
+ * Pilas de las tareas: se obtienen de un pool de regiones mmap con
+ * una pagina de guardia (PROT_NONE) bajo cada pila.  StackInit instala
+ * el handler de SIGSEGV que reporta el desborde.
+ */
+
+void StackInit();
+void AltStackInit(); /* El stack alternativo del thread actual */
+SP AllocStack(int size);
+void FreeStack(SP stack, int size);
+
+/*
+ * Slabs: caches de objetos de taman~o fijo para los descriptores que
+ * se crean y destruyen en las operaciones frecuentes (tareas, colas,
+ * elementos de FifoQueue).  SlabAlloc y SlabFree son O(1) y no hacen
+ * llamadas al sistema salvo cuando hay que agregar un bloque nuevo.
+ * Los bloques no se devuelven nunca: los objetos se reciclan.
+ */
+
+typedef struct SlabCache
+{
+  int size;         /* Taman~o de un objeto (multiplo de align) */
+  int align;        /* Alineamiento de cada objeto */
+  void *free_list;  /* Objetos libres, encadenados por su primera palabra */
+}
+  SlabCache;
+
+#define SLAB_CACHE(type, align) \
+  { (sizeof(type)+(align)-1)/(align)*(align), (align), NULL }
+
+void *SlabAlloc(SlabCache *cache);
+void SlabFree(SlabCache *cache, void *obj);
+
 /*
  * Despliegue a la ``printf'' (parametros variables):
  */
@@ -2,15 +2,21 @@
 #include <nSystem.h>
 #include <sys/time.h> /* Para gettimeofday */
 
+#include <stddef.h>   /* Para offsetof */
+
 /* Procedimientos locales del modulo: */
 
 static void RtimerHandler();
 static void AwakeTasks();
+static void TaskTimeout(Timer *timer);
+static void QueueTimeout(Timer *timer);
 
 /* Variables del modulo */
 
-static Squeue wait_squeue;
+static TimeWheel wait_wheel;
 static int init_time=0;
+static int alarm_time;      /* Para cuando esta programado el SIGALRM */
+static int alarm_set= FALSE;
 
 /*************************************************************
  * Prologo y epilogo:
@@ -18,13 +24,13 @@ static int init_time=0;
 
 void TimeInit()
 {
-  wait_squeue= MakeSqueue();
   init_time= nGetTime();
+  wait_wheel= MakeTimeWheel(nGetTime());
 }
 
 void TimeEnd()
 {
-  if (!EmptySqueue(wait_squeue))
+  if (!EmptyWheel(wait_wheel))
     nFprintf(2, "\nQuedan tareas con timeout programados\n");
 }
 
@@ -40,19 +46,42 @@ int nGetTime()
     return Timeval.tv_sec*1000+Timeval.tv_usec/1000-init_time;
 }   
 
-void ProgramTask(int timeout)
+/* Los timers se guardan en una rueda de tiempo (ver nQueue.c): programar
+ * y cancelar un timer es O(1).  Cancelar no reprograma la alarma; si
+ * suena antes de tiempo AwakeTasks no encuentra nada que despertar y
+ * la vuelve a programar.  Todos los timers vencidos se procesan en
+ * una sola pasada de AwakeTasks.
+ */
+
+void ProgramTimer(Timer *timer, int timeout, void (*expire)(Timer *))
 {
-  VerifyCritical("ProgramTask");
-  if (timeout>0)
-  {
-    int curr_time= nGetTime();
-    int wake_time= curr_time+timeout;
+  int curr_time= nGetTime();
+  int wake_time= curr_time+timeout;
 
-    if (EmptySqueue(wait_squeue) || wake_time-GetNextTimeSqueue(wait_squeue)<0)
-      SetAlarm(REALTIMER, wake_time-curr_time, RtimerHandler);
+  VerifyCritical("ProgramTimer");
 
-    PutTaskSqueue(wait_squeue, current_task, wake_time);
+  timer->expire= expire;
+  PutTimerWheel(wait_wheel, timer, wake_time);
+
+  if (!alarm_set || wake_time-alarm_time<0)
+  {
+    alarm_set= TRUE;
+    alarm_time= wake_time;
+    SetAlarm(REALTIMER, timeout>0 ? timeout : 1, RtimerHandler);
   }
+}
+
+void CancelTimer(Timer *timer)
+{
+  VerifyCritical("CancelTimer");
+  DeleteTimerWheel(wait_wheel, timer);
+}
+
+void ProgramTask(int timeout)
+{
+  VerifyCritical("ProgramTask");
+  if (timeout>0)
+    ProgramTimer(&current_task->timer, timeout, TaskTimeout);
   else
   {
     current_task->status= READY;
@@ -63,8 +92,42 @@ void ProgramTask(int timeout)
 void CancelTask(nTask task)
 {
   VerifyCritical("CancelTask");
-  DeleteTaskSqueue(wait_squeue, task);
-  AwakeTasks();
+  CancelTimer(&task->timer);
+}
+
+static void TaskTimeout(Timer *timer)
+{
+  nTask task= (nTask)((char *)timer-offsetof(struct Task, timer));
+
+  /* Ahora la tarea que dormia vuelve a estar READY */
+  task->status= READY;
+  PushTask(ready_queue, task);
+}
+
+/* Como ProgramTask (con timeout>0), para una tarea que espera en una
+ * cola (task->queue).  Si el timeout vence, la tarea sale de esa cola,
+ * pasa a READY y queda con timed_out verdadero.  Quien la saque antes
+ * de la cola debe invocar CancelTask.  Lo usan nWaitSemTimeout,
+ * nEnterTimeout, nWaitConditionTimeout, nSendTimeout y
+ * nWaitTaskTimeout.
+ */
+
+void ProgramQueueTask(int timeout)
+{
+  VerifyCritical("ProgramQueueTask");
+  current_task->timed_out= FALSE;
+  ProgramTimer(&current_task->timer, timeout, QueueTimeout);
+}
+
+static void QueueTimeout(Timer *timer)
+{
+  nTask task= (nTask)((char *)timer-offsetof(struct Task, timer));
+
+  if (task->queue!=NULL)
+    DeleteTaskQueue(task->queue, task);
+  task->timed_out= TRUE;
+  task->status= READY;
+  PushTask(ready_queue, task);
 }
 
 static void AwakeTasks()
@@ -72,21 +135,20 @@ static void AwakeTasks()
   int curr_time= nGetTime();
 
   /* Despertamos todas las tareas con wake_time<=curr_time */
+  ExpireTimersWheel(wait_wheel, curr_time);
 
-  while (! EmptySqueue(wait_squeue) &&
-         GetNextTimeSqueue(wait_squeue)<=curr_time)
+  /* Preparamos la proxima interrupcion */
+  if (EmptyWheel(wait_wheel))
   {
-    nTask task= GetTaskSqueue(wait_squeue);
-    /* Ahora la tarea que dormia vuelve a estar READY */   
-    task->status= READY;
-    PushTask(ready_queue, task);
+    alarm_set= FALSE;
+    SetAlarm(REALTIMER, 0, RtimerHandler);
+  }
+  else
+  {
+    alarm_set= TRUE;
+    alarm_time= GetNextTimeWheel(wait_wheel);
+    SetAlarm(REALTIMER, alarm_time-curr_time, RtimerHandler);
   }
-
-  /* Preparamos la proxima interrupcion */
-  SetAlarm(REALTIMER,
-           EmptySqueue(wait_squeue) ?
-             0 : GetNextTimeSqueue(wait_squeue)-curr_time,
-           RtimerHandler);
 }
 
 static void RtimerHandler()